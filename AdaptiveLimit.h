@@ -0,0 +1,40 @@
+#ifndef ADAPTIVELIMIT_H
+#define ADAPTIVELIMIT_H
+
+#include <stdint.h>
+#include <algorithm>
+
+// Number of operations to keep outstanding, adjusted after every WINDOW
+// outcomes: halved when more than 1 in 20 timed out, raised by an eighth
+// when none did. Not thread-safe.
+class AdaptiveLimit {
+  public:
+    static const uint64_t WINDOW = 32;
+
+    AdaptiveLimit(uint64_t initial, uint64_t minimum, uint64_t maximum):
+      limit(initial), minimum(minimum), maximum(maximum), outcomes(0), timeouts(0) { }
+
+    uint64_t get() const {
+      return limit;
+    }
+
+    void record(bool timedOut) {
+      timeouts += timedOut;
+      if(++outcomes < WINDOW) return;
+
+      if(timeouts * 20 > outcomes) {
+        limit = std::max(minimum, limit / 2);
+      } else if(!timeouts) {
+        limit = std::min(maximum, limit + limit / 8 + 1);
+      }
+
+      outcomes = timeouts = 0;
+    }
+
+  private:
+    uint64_t limit;
+    uint64_t minimum, maximum;
+    uint64_t outcomes, timeouts;
+};
+
+#endif
@@ -0,0 +1,184 @@
+#ifndef BLOCKEDBLOOMSET_H
+#define BLOCKEDBLOOMSET_H
+
+#include "MappedFile.h"
+#include "Hash.h"
+
+#include <emmintrin.h>
+#include <iostream>
+#include <string>
+#include <stdexcept>
+
+// Bloom filter which hashes each key once and keeps all its bits within a
+// single 64 byte block (i.e. one cache line): The block is split into 16
+// 32-bit lanes and each key sets exactly one bit per lane.
+class BlockedBloomSet {
+  public:
+    static const int BITS_PER_ELEMENT = 24;
+
+    BlockedBloomSet(uint64_t expectedElements, int bitsPerElement = BITS_PER_ELEMENT) {
+      init(expectedElements, bitsPerElement);
+      memory = new MappedFile(HEADER_SIZE + blocks * BLOCK_SIZE);
+      data = memory->getData() + HEADER_SIZE;
+      header = reinterpret_cast<Header *>(memory->getData());
+    }
+
+    // keeps the set in the given file, reopening it if it already exists
+    BlockedBloomSet(uint64_t expectedElements, const std::string &filename, int bitsPerElement = BITS_PER_ELEMENT) {
+      init(expectedElements, bitsPerElement);
+      memory = new MappedFile(filename, HEADER_SIZE + blocks * BLOCK_SIZE);
+      data = memory->getData() + HEADER_SIZE;
+      header = reinterpret_cast<Header *>(memory->getData());
+
+      // Processes sharing the file may create it at the same time: the magic is
+      // published last, so whoever sees it also sees the size. Without it the
+      // header is (re)written, with the same values by every compatible process.
+      uint64_t magic;
+      memcpy(&magic, MAGIC, sizeof(magic));
+      if(!__atomic_load_n(&header->magic, __ATOMIC_ACQUIRE)) {
+        __atomic_store_n(&header->blocks, blocks, __ATOMIC_RELAXED);
+        __atomic_store_n(&header->magic, magic, __ATOMIC_RELEASE);
+      }
+
+      if(__atomic_load_n(&header->magic, __ATOMIC_ACQUIRE) != magic || __atomic_load_n(&header->blocks, __ATOMIC_RELAXED) != blocks) {
+        delete memory;
+        throw std::runtime_error("incompatible bloom filter in " + filename);
+      }
+    }
+
+    ~BlockedBloomSet() {
+      delete memory;
+    }
+
+    bool contains(const char *str, const size_t n) { return contains(hashBytes(str, n)); }
+    bool contains(const std::string &s) { return contains(s.c_str(), s.length()); }
+
+    // return true if the element already existed
+    bool insert(const char *str, const size_t n) { return insert(hashBytes(str, n)); }
+    bool insert(const std::string &s) { return insert(s.c_str(), s.length()); }
+
+    bool contains(uint64_t hash) {
+      __m128i mask[4];
+      makeMask(hash, mask);
+      return test(block(hash), mask);
+    }
+
+    // safe to call from multiple threads (or processes sharing the file)
+    bool insert(uint64_t hash) {
+      __m128i mask[4];
+      makeMask(hash, mask);
+
+      __m128i *b = block(hash);
+      if(test(b, mask)) return true;
+
+      uint64_t words[8] __attribute__((aligned(16)));
+      for(int i = 0; i < 4; ++i) _mm_store_si128(reinterpret_cast<__m128i *>(words) + i, mask[i]);
+
+      uint64_t *w = reinterpret_cast<uint64_t *>(b);
+      bool existed = true;
+      for(int i = 0; i < 8; ++i) {
+        existed &= (__atomic_fetch_or(w + i, words[i], __ATOMIC_RELAXED) & words[i]) == words[i];
+      }
+
+      if(!existed) __atomic_fetch_add(&header->elements, 1, __ATOMIC_RELAXED);
+      return existed;
+    }
+
+    // exact number of distinct elements inserted so far
+    uint64_t getElements() const { return __atomic_load_n(&header->elements, __ATOMIC_RELAXED); }
+    uint64_t getMemory() const { return blocks * BLOCK_SIZE; }
+
+    int estimateFill() {
+      int fill = 0;
+      unsigned int max = 256;
+      if(blocks * BLOCK_SIZE < max) max = blocks * BLOCK_SIZE;
+
+      for(unsigned int i = 0; i < max; ++i) fill += data[i] & 1;
+      return (fill * 1000) / max;
+    }
+
+    void sync(bool wait = false) {
+      memory->sync(wait);
+    }
+
+    void save(std::ostream &out) const {
+      out.write(reinterpret_cast<const char *>(&blocks), sizeof(blocks));
+      out.write(reinterpret_cast<const char *>(&header->elements), sizeof(header->elements));
+      out.write(reinterpret_cast<const char *>(data), blocks * BLOCK_SIZE);
+    }
+
+    static BlockedBloomSet *load(std::istream &in) {
+      uint64_t blocks, elements;
+      in.read(reinterpret_cast<char *>(&blocks), sizeof(blocks));
+      in.read(reinterpret_cast<char *>(&elements), sizeof(elements));
+      if(!in.good()) throw std::runtime_error("truncated bloom filter");
+
+      BlockedBloomSet *set = new BlockedBloomSet(blocks * BLOCK_SIZE * 8 / BITS_PER_ELEMENT);
+      if(set->blocks != blocks) {
+        delete set;
+        throw std::runtime_error("incompatible bloom filter");
+      }
+
+      in.read(reinterpret_cast<char *>(set->data), blocks * BLOCK_SIZE);
+      if(!in.good()) {
+        delete set;
+        throw std::runtime_error("truncated bloom filter");
+      }
+
+      set->header->elements = elements;
+      return set;
+    }
+
+  private:
+    static const int HEADER_SIZE = 64;
+    static const int BLOCK_SIZE = 64;
+    static constexpr const char *MAGIC = "BlkBloom";
+
+    struct Header {
+      uint64_t magic;  // MAGIC, written after blocks
+      uint64_t blocks;
+      uint64_t elements;
+    };
+
+    uint64_t blocks;
+    unsigned char *data;
+    Header *header;
+    MappedFile *memory;
+
+    void init(uint64_t expectedElements, int bitsPerElement) {
+      if(expectedElements == 0) expectedElements = 2;
+
+      // 24 bits give ~0.0001 probability, blocking needs 20% more bits than BloomSet for that
+      blocks = (expectedElements * bitsPerElement + BLOCK_SIZE * 8 - 1) / (BLOCK_SIZE * 8);
+    }
+
+    __m128i *block(uint64_t hash) {
+      // multiply-shift instead of a 64-bit %
+      return reinterpret_cast<__m128i *>(data + ((hash >> 32) * blocks >> 32) * BLOCK_SIZE);
+    }
+
+    static void makeMask(uint64_t hash, __m128i *mask) {
+      static const uint32_t salt[16] __attribute__((aligned(16))) = {
+        0x47B6137Bu, 0x44974D91u, 0x8824AD5Bu, 0xA2B7289Du,
+        0x705495C7u, 0x2DF1424Bu, 0x9EFC4947u, 0x5C6BFB31u,
+        0x7E3A4C1Fu, 0xB6D2A1E9u, 0x1F83D9ABu, 0x5BE0CD19u,
+        0xC1059ED9u, 0x367CD507u, 0xF70E5939u, 0x64F98FA7u,
+      };
+
+      uint32_t bits[16] __attribute__((aligned(16)));
+      uint32_t h = static_cast<uint32_t>(hash);
+      for(int i = 0; i < 16; ++i) bits[i] = 1u << ((h * salt[i]) >> 27);
+
+      for(int i = 0; i < 4; ++i) mask[i] = _mm_load_si128(reinterpret_cast<const __m128i *>(bits) + i);
+    }
+
+    static bool test(const __m128i *b, const __m128i *mask) {
+      __m128i missing = _mm_setzero_si128();
+      for(int i = 0; i < 4; ++i) missing = _mm_or_si128(missing, _mm_andnot_si128(_mm_load_si128(b + i), mask[i]));
+      return _mm_movemask_epi8(_mm_cmpeq_epi8(missing, _mm_setzero_si128())) == 0xFFFF;
+    }
+
+    BlockedBloomSet(const BlockedBloomSet &);
+};
+
+#endif
@@ -1,25 +1,40 @@
 #ifndef BLOOMSET_H
 #define BLOOMSET_H
 
+#include "MappedFile.h"
+
 #include <strings.h>
 #include <iostream>
 #include <string>
+#include <stdexcept>
 
 class BloomSet {
   public:
     BloomSet(uint64_t expectedElements) {
-      if(expectedElements == 0) expectedElements = 2;
-
-      // let's aim for ~0.0001 probability
-      bits = expectedElements * 20;
-      keybits = 7 * bits / expectedElements / 10;
-      data = new unsigned char[bits / 8 + 1];
+      init(expectedElements);
+      memory = new MappedFile(HEADER_SIZE + bits / 8 + 1);
+      data = memory->getData() + HEADER_SIZE;
+    }
 
-      bzero(data, bits / 8 + 1);
+    // keeps the set in the given file, reopening it if it already exists
+    BloomSet(uint64_t expectedElements, const std::string &filename) {
+      init(expectedElements);
+      memory = new MappedFile(filename, HEADER_SIZE + bits / 8 + 1);
+      data = memory->getData() + HEADER_SIZE;
+
+      Header *header = reinterpret_cast<Header *>(memory->getData());
+      if(memory->isFresh()) {
+        memcpy(header->magic, MAGIC, sizeof(header->magic));
+        header->bits = bits;
+        header->keybits = keybits;
+      } else if(memcmp(header->magic, MAGIC, sizeof(header->magic)) || header->bits != bits || header->keybits != keybits) {
+        delete memory;
+        throw std::runtime_error("incompatible bloom filter in " + filename);
+      }
     }
 
     ~BloomSet() {
-      delete[] data;
+      delete memory;
     }
 
     bool contains(const char *str, const size_t n) { return countBits(str, n) >= keybits; }
@@ -38,10 +53,59 @@ class BloomSet {
       return (fill * 1000) / max;
     }
 
+    void sync(bool wait = false) {
+      memory->sync(wait);
+    }
+
+    void save(std::ostream &out) const {
+      out.write(reinterpret_cast<const char *>(&bits), sizeof(bits));
+      out.write(reinterpret_cast<const char *>(&keybits), sizeof(keybits));
+      out.write(reinterpret_cast<const char *>(data), bits / 8 + 1);
+    }
+
+    static BloomSet *load(std::istream &in) {
+      uint64_t bits, keybits;
+      in.read(reinterpret_cast<char *>(&bits), sizeof(bits));
+      in.read(reinterpret_cast<char *>(&keybits), sizeof(keybits));
+      if(!in.good()) throw std::runtime_error("truncated bloom filter");
+
+      BloomSet *set = new BloomSet(bits / 20);
+      if(set->bits != bits || set->keybits != keybits) {
+        delete set;
+        throw std::runtime_error("incompatible bloom filter");
+      }
+
+      in.read(reinterpret_cast<char *>(set->data), bits / 8 + 1);
+      if(!in.good()) {
+        delete set;
+        throw std::runtime_error("truncated bloom filter");
+      }
+
+      return set;
+    }
+
   private:
+    static const int HEADER_SIZE = 64;
+    static constexpr const char *MAGIC = "BloomSet";
+
+    struct Header {
+      char magic[8];
+      uint64_t bits;
+      uint64_t keybits;
+    };
+
     uint64_t bits;
     uint64_t keybits;
     unsigned char *data;
+    MappedFile *memory;
+
+    void init(uint64_t expectedElements) {
+      if(expectedElements == 0) expectedElements = 2;
+
+      // let's aim for ~0.0001 probability
+      bits = expectedElements * 20;
+      keybits = 7 * bits / expectedElements / 10;
+    }
 
     unsigned int setBits(const char *str, const size_t n) {
       unsigned int count = 0;
@@ -99,6 +163,8 @@ class BloomSet {
 
       return lastBit;
     }
+
+    BloomSet(const BloomSet &);
 };
 
 #endif
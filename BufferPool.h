@@ -0,0 +1,82 @@
+#ifndef BUFFERPOOL_H
+#define BUFFERPOOL_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+#include <cassert>
+
+// Socket buffers of power-of-two sizes from MIN_SIZE to MAX_SIZE. They are
+// carved from large slabs and recycled through one free list per size, so
+// memory follows the number of open connections rather than of domains.
+// Not thread-safe, every worker has its own pool.
+class BufferPool {
+  public:
+    static const size_t MIN_SIZE = 4096;
+    static const size_t MAX_SIZE = 65536;
+
+    BufferPool(size_t slabSize = 1024 * 1024): slabSize(slabSize), slabPos(0), slabEnd(0), used(0) { }
+
+    ~BufferPool() {
+      for(auto slab: slabs) delete[] slab;
+    }
+
+    // size is rounded up to the next buffer size (at most MAX_SIZE)
+    char *allocate(size_t &size) {
+      int c = sizeClass(size);
+      size = MIN_SIZE << c;
+      used += size;
+
+      if(!free[c].empty()) {
+        char *b = free[c].back();
+        free[c].pop_back();
+        return b;
+      }
+
+      if(slabPos + size > slabEnd) {
+        slabs.push_back(slabPos = new char[slabSize]);
+        slabEnd = slabPos + slabSize;
+      }
+
+      char *b = slabPos;
+      slabPos += size;
+      return b;
+    }
+
+    void release(char *b, size_t size) {
+      int c = sizeClass(size);
+      assert(size == MIN_SIZE << c);
+
+      free[c].push_back(b);
+      used -= size;
+    }
+
+    // bytes handed out
+    uint64_t getUsed() const {
+      return used;
+    }
+
+    // bytes taken from the system
+    uint64_t getReserved() const {
+      return slabs.size() * slabSize;
+    }
+
+  private:
+    static const int CLASSES = 5;
+
+    size_t slabSize;
+    std::vector<char *> slabs;
+    char *slabPos, *slabEnd;
+    std::vector<char *> free[CLASSES];
+    uint64_t used;
+
+    static int sizeClass(size_t size) {
+      int c = 0;
+      while(c < CLASSES - 1 && (MIN_SIZE << c) < size) ++c;
+      return c;
+    }
+
+    BufferPool(const BufferPool &);
+};
+
+#endif
@@ -0,0 +1,84 @@
+#ifndef DNSCACHE_H
+#define DNSCACHE_H
+
+#include "SocketAddress.h"
+
+#include <stdint.h>
+#include <time.h>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <mutex>
+#include <iostream>
+#include <sstream>
+
+// Resolved addresses with their expiry (wall clock seconds, so they stay
+// valid across runs). Thread-safe, shared by all workers.
+class DnsCache {
+  public:
+    // false if the host is unknown or its entry expired
+    bool lookup(const std::string &host, std::vector<SocketAddress> &addresses, time_t now = time(0)) {
+      std::lock_guard<std::mutex> lock(mutex);
+
+      auto i = entries.find(host);
+      if(i == entries.end()) return false;
+      if(i->second.expires <= now) {
+        entries.erase(i);
+        return false;
+      }
+
+      addresses = i->second.addresses;
+      return true;
+    }
+
+    void insert(const std::string &host, const std::vector<SocketAddress> &addresses, time_t expires) {
+      std::lock_guard<std::mutex> lock(mutex);
+      entries[host] = Entry { addresses, expires };
+    }
+
+    size_t size() {
+      std::lock_guard<std::mutex> lock(mutex);
+      return entries.size();
+    }
+
+    // one "<host> <expires> <address>..." line per entry still valid
+    void save(std::ostream &out, time_t now = time(0)) {
+      std::lock_guard<std::mutex> lock(mutex);
+      for(auto &e: entries) {
+        if(e.second.expires <= now) continue;
+
+        out << e.first << ' ' << e.second.expires;
+        for(auto &a: e.second.addresses) out << ' ' << a.toString();
+        out << '\n';
+      }
+    }
+
+    void load(std::istream &in, time_t now = time(0)) {
+      std::string line, host, address;
+
+      std::lock_guard<std::mutex> lock(mutex);
+      while(getline(in, line)) {
+        std::istringstream fields(line);
+        Entry e;
+        if(!(fields >> host >> e.expires)) continue;
+
+        while(fields >> address) {
+          SocketAddress a;
+          if(a.parse(address)) e.addresses.push_back(a);
+        }
+
+        if(e.expires > now && !e.addresses.empty()) entries[host] = e;
+      }
+    }
+
+  private:
+    struct Entry {
+      std::vector<SocketAddress> addresses;
+      time_t expires;
+    };
+
+    std::mutex mutex;
+    std::unordered_map<std::string, Entry> entries;
+};
+
+#endif
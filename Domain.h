@@ -1,29 +1,50 @@
 #ifndef DOMAIN_H
 #define DOMAIN_H
 
-#include "DomainStream.h"
-#include "PrefixSet.h"
+#include "OutputLog.h"
+#include "RobotsRules.h"
 #include "PostfixSet.h"
-#include "BloomSet.h"
+#include "PathFrontier.h"
+#include "ScalableBloomSet.h"
+#include "LineScanner.h"
+#include "LinkScanner.h"
+#include "HttpResponse.h"
+#include "Inflater.h"
+#include "TimerWheel.h"
+#include "IoBackend.h"
+#include "BufferPool.h"
+#include "HostFrontier.h"
+#include "IpCooldown.h"
+#include "HostPace.h"
+#include "SimHash.h"
+#include "Metrics.h"
+#include "UrlMetadata.h"
+#include "Shards.h"
+#include "HostName.h"
 
 #include <stdint.h>
 #include <vector>
 #include <list>
+#include <algorithm>
 #include <string>
 #include <stdexcept>
 #include <iostream>
 #include <iomanip>
 #include <sstream>
-#include <netinet/ip.h>
 #include <cassert>
-#include <unistd.h>
 #include <string.h>
-#include <sys/time.h>
+#include <strings.h>
+#include <time.h>
 
 class Domain {
   public:
-    Domain(const std::string &url): socket(0), inBuffer(0), outBuffer(0) {
+    Domain(const std::string &url): output(0), recording(false), connection(0), buffers(0), inBuffer(0), outBuffer(0), seenUrls(0), hostFrontier(0), ipCooldown(0), notBefore(0), pageIndex(0), fingerprint(0), hostLines(0), hostPages(0), urlMetadata(0), recrawl(false), shards(0), connectSeconds(0) {
       hostname = extractHost(url);
+      size_t colon = hostname.find(':');
+      dnsName = hostname.substr(0, colon);
+      port = colon == std::string::npos? 80: atoi(hostname.c_str() + colon + 1);
+      connectTimeoutMilliseconds = 5000;
+      connectFailures = 0;
       searchFront.push_back("/robots.txt");
       robotsTxtActive = true;
       robotsTxtRelevant = true;
@@ -32,8 +53,11 @@ class Domain {
 
       maximalUrlLength = 256;
       maximalDownloaded = 2000000;
-      
-      gettimeofday(&lastActivity, 0);
+      maximalSkipped = 16 * 1024;
+      requestsInFlight = 0;
+      responseSize = INITIAL_RESPONSE_SIZE;
+
+      lastActivity = monotonicMilliseconds();
     }
 
     void fetch(const std::string &url) {
@@ -47,153 +71,394 @@ class Domain {
     }
 
     void setCooldownMilliseconds(uint64_t ms) {
-      cooldownMilliseconds = ms;
+      pace.setCooldown(ms);
+    }
+
+    // Adapts the cooldown within [minMs, maxMs] and the requests in flight up
+    // to the pipeline depth to how the host copes, see HostPace.
+    void setAdaptivePoliteness(uint64_t minMs, uint64_t maxMs) {
+      pace.setBounds(minMs, maxMs);
     }
 
     void setRecursionMode(uint64_t mode) {
       recursionMode = mode;
     }
 
-    void setOutputPath(const std::string &path) {
-      outputPath = path;
+    // number of requests sent ahead on a persistent connection
+    void setPipelineDepth(uint64_t depth) {
+      pace.setMaxDepth(std::min<uint64_t>(depth, MAX_PIPELINE_DEPTH));
+    }
+
+    void setOutputLog(OutputLog *log) {
+      output = log;
+    }
+
+    // socket buffers are only taken from the pool while connected
+    void setBufferPool(BufferPool *pool) {
+      buffers = pool;
     }
 
-    void setIp(uint32_t addr) {
-      ip = addr;
+    void setFrontierSpill(FrontierSpill *spill) {
+      searchFront.setSpill(spill);
     }
 
-    void setSeenLines(BloomSet *lines) {
+    // Addresses of the server, tried alternating between IPv6 and IPv4 (as
+    // in RFC 8305), with the port of the URL.
+    void setAddresses(const std::vector<SocketAddress> &resolved) {
+      addresses.clear();
+
+      for(size_t v6 = 0, v4 = 0; v6 < resolved.size() || v4 < resolved.size();) {
+        while(v6 < resolved.size() && !resolved[v6].isIpv6()) ++v6;
+        if(v6 < resolved.size()) addresses.push_back(resolved[v6++]);
+
+        while(v4 < resolved.size() && resolved[v4].isIpv6()) ++v4;
+        if(v4 < resolved.size()) addresses.push_back(resolved[v4++]);
+      }
+
+      for(auto &a: addresses) a.setPort(port);
+    }
+
+    // A connection not established within the timeout counts as failed.
+    // Hosts are retried after a pause doubling with every failure, and given
+    // up after MAX_CONNECT_FAILURES in a row.
+    void setConnectTimeoutMilliseconds(uint64_t ms) {
+      connectTimeoutMilliseconds = ms;
+    }
+
+    // Pages found to be near-duplicates in the index yield no links. Only whole
+    // pages are compared, so their links wait until the page is complete.
+    void setNearDuplicateIndex(SimHashIndex *index) {
+      pageIndex = index;
+    }
+
+    // shares the cooldown with the other hosts on the same server
+    void setIpCooldown(IpCooldown *cooldown) {
+      ipCooldown = cooldown;
+    }
+
+    void setSeenLines(ScalableBloomSet *lines) {
       seenLines = lines;
     }
 
+    // new lines are also sent to the other shards, for those not sharing the filter
+    void setLineForwarding(Shards *s) {
+      shards = s;
+    }
+
     void setIgnoreList(PostfixSet *ignore) {
       ignoreList = ignore;
     }
 
+    // links to other hosts are handed to the frontier, and dropped without one
+    void setHostFrontier(HostFrontier *frontier) {
+      hostFrontier = frontier;
+    }
+
+    // Fetches are remembered in the store. When recrawling, pages are requested
+    // conditionally and only recorded if they changed.
+    void setUrlMetadata(UrlMetadataStore *store, bool recrawlMode) {
+      urlMetadata = store;
+      recrawl = store && recrawlMode;
+    }
+
+    // timings and byte counts of all fetches go here, nothing is measured without
+    void setMetrics(Metrics &metrics) {
+      connectSeconds = &metrics.histogram("crawler_connect_seconds", "Time to establish a connection.");
+      firstByteSeconds = &metrics.histogram("crawler_first_byte_seconds", "Time from the request to the first byte of its response.");
+      fetchSeconds = &metrics.histogram("crawler_fetch_seconds", "Time from the request to the end of its response.");
+      receivedBytes = &metrics.counter("crawler_received_bytes_total", "Bytes received from servers.");
+      newBytes = &metrics.counter("crawler_new_bytes_total", "Bytes of lines not seen before.");
+      pages = &metrics.counter("crawler_pages_total", "Responses received completely.");
+      compressedBytes = &metrics.counter("crawler_compressed_bytes_total", "Compressed body bytes received.");
+      inflatedBytes = &metrics.counter("crawler_inflated_bytes_total", "Bytes of text decompressed from them.");
+      skippedResponses = &metrics.counter("crawler_skipped_responses_total", "Responses dropped for their status or content type.");
+      connectFailuresTotal = &metrics.counter("crawler_connect_failures_total", "Connections which failed or timed out on all addresses.");
+      unreachableHosts = &metrics.counter("crawler_unreachable_hosts_total", "Hosts given up after repeated connect failures.");
+      unchangedPages = &metrics.counter("crawler_unchanged_pages_total", "Recrawled pages not modified since the last fetch.");
+    }
+
     const std::string &getHostname() const {
       return hostname;
     }
 
-    std::string getIpString() const {
-      std::ostringstream out;
+    bool isFinished() const {
+      return searchFront.empty();
+    }
 
-      out << ((ip      ) & 255) << '.'
-          << ((ip >>  8) & 255) << '.'
-          << ((ip >> 16) & 255) << '.'
-          << ((ip >> 24) & 255);
+    // the host name without port, to be resolved
+    const std::string &getDnsName() const {
+      return dnsName;
+    }
 
-      return out.str();
+    std::string getAddressString() const {
+      return addresses.empty()? "": addresses.front().toString();
     }
 
-    template<class A> void startDownloading(const A &add) {
+    // completions of this domain's connections will carry the slot
+    void startDownloading(IoBackend &io, uint64_t slot) {
       if(searchFront.empty()) return;
 
-      seenUrls = new BloomSet(remainingFetches);
-      for(auto &url: searchFront) seenUrls->insert(url);
+      if(!seenUrls) {
+        seenUrls = new BlockedBloomSet(remainingFetches);
+        searchFront.each([&](const std::string &url) { seenUrls->insert(url); });
 
-      while(remainingFetches < searchFront.size()) searchFront.pop_back();
-      remainingFetches -= searchFront.size();
+        searchFront.truncate(remainingFetches);
+        remainingFetches -= searchFront.size();
+      }
 
-      output = new DomainStream(outputPath + "/" + hostname);
+      if(pageIndex && !fingerprint) {
+        fingerprint = new SimHash();
+        hostLines = new BlockedBloomSet(2 * HOST_LINES);
+        hostPages = 0;
+      }
 
-      inBuffer = new char[BUFFER_SIZE];
-      outBuffer = new char[BUFFER_SIZE];
+      ioSlot = slot;
+      if(!reserveServer(monotonicMilliseconds())) return;
 
-      openSocket(add);
-      startRequest();
+      openSocket(io);
+      queueRequests();
     }
 
     void finishDownloading() {
-      if(!inBuffer) return;
-      delete[] inBuffer;
-      inBuffer = 0;
+      if(!seenUrls) return;
+      assert(!connection);
 
-      assert(outBuffer);
-      delete[] outBuffer;
-      outBuffer = 0;
-
-      assert(seenUrls);
       delete seenUrls;
       seenUrls = 0;
+      delete fingerprint;
+      fingerprint = 0;
+      delete hostLines;
+      hostLines = 0;
+      std::vector<uint64_t>().swap(pageLines);
+      std::vector<std::pair<std::string, LinkScanner::Kind>>().swap(pageLinks);
+
+      std::string().swap(page);
+    }
+
+    // The request in progress stays in the search front and is simply repeated on resume.
+    void saveState(std::ostream &out) {
+      out << remainingFetches << ' ' << robotsTxtActive << ' ' << (robotsTxtActive? 0: robotsTxt.size()) << ' '
+        << searchFront.size() << ' ' << !!seenUrls << ' ' << pace.getFloor() << '\n';
 
-      assert(output);
-      delete output;
-      output = 0;
+      if(!robotsTxtActive) robotsTxt.each([&](const std::string &pattern, bool allow) { out << (allow? '+': '-') << pattern << '\n'; });
+      searchFront.each([&](const std::string &url) { out << url << '\n'; });
+      if(seenUrls) seenUrls->save(out);
     }
 
-    template<class A, class M, class D, class F> void handleInput(const A &add, const M &, const D &del, const F &finish) {
-      gettimeofday(&lastActivity, 0);
+    void loadState(std::istream &in) {
+      uint64_t robotsTxtSize, searchFrontSize, crawlDelay;
+      bool hasSeenUrls;
 
-      if(inBufferFill == inBuffer + BUFFER_SIZE) {
-        // Yes, this looses data in very long lines.
+      in >> remainingFetches >> robotsTxtActive >> robotsTxtSize >> searchFrontSize >> hasSeenUrls >> crawlDelay;
+      in.get();
+      if(crawlDelay) pace.setFloor(crawlDelay);
 
-        memmove(inBuffer, inBufferPos, inBufferFill - inBufferPos);
+      std::string line;
+      robotsTxt = RobotsRules();
+      for(uint64_t i = 0; i < robotsTxtSize; ++i) {
+        getline(in, line);
+        if(line.empty()) throw std::runtime_error("corrupt checkpoint for " + hostname);
+        robotsTxt.insert(line.substr(1), line[0] == '+');
+      }
 
-        inBufferFill -= inBufferPos - inBuffer;
-        inBufferPos = inBuffer;
+      searchFront.clear();
+      for(uint64_t i = 0; i < searchFrontSize; ++i) {
+        getline(in, line);
+        searchFront.push_back(line);
       }
 
-      ssize_t len = read(socket, inBufferFill, inBuffer + BUFFER_SIZE - inBufferFill);
+      delete seenUrls;
+      seenUrls = hasSeenUrls? BlockedBloomSet::load(in): 0;
+
+      if(!in.good()) throw std::runtime_error("corrupt checkpoint for " + hostname);
+
+      robotsTxtRelevant = true;
+    }
+
+    template<class F> void handleCompletion(IoBackend &io, const IoCompletion &completion, const F &finish) {
+      // left over from a connection closed in the meantime
+      if(completion.connection != connection && std::find(attempts.begin(), attempts.end(), completion.connection) == attempts.end()) return;
+
+      switch(completion.operation) {
+        case IO_CONNECT: handleConnect(io, completion.connection, completion.result, finish); break;
+        case IO_RECEIVE: handleInput(io, completion.result, finish); break;
+        case IO_SEND: handleOutput(io, completion.result, finish); break;
+      }
+    }
+
+    // Any of the attempts racing on the addresses may complete, the first one
+    // established wins.
+    template<class F> void handleConnect(IoBackend &io, uint64_t attempt, int64_t result, const F &finish) {
+      if(result < 0) {
+        if(attempt != connection) {
+          // an older attempt, the newest one is still running
+          io.close(attempt);
+          attempts.erase(std::find(attempts.begin(), attempts.end(), attempt));
+        } else if(nextAddress < addresses.size()) {
+          io.close(connection);
+          connection = io.connect(ioSlot, addresses[nextAddress++]);
+          nextAttemptAt = monotonicMilliseconds() + CONNECT_STAGGER_MILLISECONDS;
+        } else if(!attempts.empty()) {
+          io.close(connection);
+          connection = attempts.back();
+          attempts.pop_back();
+        } else {
+          handleConnectFailure(io, finish);
+        }
+        return;
+      }
+
+      if(attempt != connection) {
+        io.close(connection);
+        connection = attempt;
+      }
+      for(auto a: attempts) if(a != connection) io.close(a);
+      attempts.clear();
+
+      connected = true;
+      connectFailures = 0;
+      if(connectSeconds) connectSeconds->record(monotonicMicroseconds() - connectStarted);
+
+      sendRequests(io);
+      receive(io);
+    }
+
+    template<class F> void handleInput(IoBackend &io, int64_t len, const F &finish) {
+      lastActivity = monotonicMilliseconds();
+      receiving = false;
 
       if(len < 0) {
-        std::cerr << "read failed in weird ways: " + std::string(strerror(errno)) << std::endl;
-        handleEnd(add, del, finish);
+        std::cerr << "read failed in weird ways: " + std::string(strerror(-len)) << std::endl;
+        recordFailure();
+        handleEnd(io, finish);
+        return;
       } else if(len == 0) {
-        handleEnd(add, del, finish);
-      } else {
-        reportDownloaded += len;
-        currentDownloaded += len;
+        response.handleEof();
+        if(response.isComplete()) finishResponse();
 
-        if(currentDownloaded > maximalDownloaded) {
-          std::cerr << "File was too large: " << searchFront.front() << std::endl;
-          handleEnd(add, del, finish);
+        handleEnd(io, finish);
+        return;
+      }
+
+      reportDownloaded += len;
+      inBufferFill += len;
+      if(connectSeconds) receivedBytes->add(len);
+
+      while(inBufferBody != inBufferFill) {
+        if(!requestsInFlight) {
+          std::cerr << hostname << ": unexpected data from server" << std::endl;
+          handleEnd(io, finish);
           return;
         }
 
-        inBufferFill += len;
-
-        for(char *s = inBufferPos; s != inBufferFill; ++s) {
-          // uint64_t v = *reinterpret_cast<uint64_t *>(s);
-          // if(s < inBufferFill - 8 &&
-          //    (v & 0xff00000000000000ull) != 0x0a00000000000000ull &&
-          //    (v & 0x00ff000000000000ull) != 0x000a000000000000ull &&
-          //    (v & 0x0000ff0000000000ull) != 0x00000a0000000000ull &&
-          //    (v & 0x000000ff00000000ull) != 0x0000000a00000000ull &&
-          //    (v & 0x00000000ff000000ull) != 0x000000000a000000ull &&
-          //    (v & 0x0000000000ff0000ull) != 0x00000000000a0000ull &&
-          //    (v & 0x000000000000ff00ull) != 0x0000000000000a00ull &&
-          //    (v & 0x00000000000000ffull) != 0x000000000000000aull) {
-          //   s += 7; continue;
-          // }
-          if(s < inBufferFill - 4) {
-            uint32_t v = *reinterpret_cast<uint32_t *>(s);
-            if((v & 0xff000000ul) != 0xa000000ul &&
-               (v & 0x00ff0000ul) != 0x00a0000ul &&
-               (v & 0x0000ff00ul) != 0x0000a00ul &&
-               (v & 0x000000fful) != 0x000000aul) {
-              s += 3; continue;
-            }
+        if(connectSeconds && !response.isStarted()) firstByteSeconds->record(monotonicMicroseconds() - requestStarted);
+
+        // pipelined responses following this one stay raw, behind the decoded body
+        char *raw = inBufferBody;
+        char *body = response.decode(inBufferBody, raw, inBufferFill);
+
+        if(!headersChecked && response.hasHeaders()) {
+          headersChecked = true;
+          skipping = !acceptResponse();
+          if(!skipping && response.getEncoding() != HttpResponse::IDENTITY) startInflating();
+
+          // a skipped body is only waited for if it is short, to keep the connection
+          int64_t length = response.getContentLength();
+          if(skipping && !response.isComplete() && (length < 0 || static_cast<uint64_t>(length) > maximalSkipped)) {
+            if(connectSeconds) skippedResponses->add();
+            recording = false;
+            handleEnd(io, finish);
+            return;
           }
+        }
 
-          if(*s == '\n') {
-            // (this->*(robotsTxtActive? &Domain::handleRobotsTxtLine: &Domain::handleLine))(inBufferPos, s);
-            if(robotsTxtActive) handleRobotsTxtLine(inBufferPos, s + 1);
-            if(!robotsTxtActive) handleLine(inBufferPos, s + 1);
+        if(skipping) body = inBufferBody;
+        recording = !skipping;
 
-            inBufferPos = s + 1;
+        if(inflating) {
+          // the compressed bytes are not kept, the text goes to the text buffer
+          bool intact = inflateBody(inBufferBody, body);
+          body = inBufferBody;
+
+          if(!intact) {
+            std::cerr << hostname << ": corrupt compressed body: " << searchFront.front() << std::endl;
+            handleEnd(io, finish);
+            return;
           }
+        } else {
+          scanLinks(inBufferBody, body);
         }
+
+        if(body != raw) memmove(body, raw, inBufferFill - raw);
+        inBufferFill = body + (inBufferFill - raw);
+        inBufferBody = body;
+
+        if(!inflating) {
+          inBufferPos = const_cast<char *>(lineScanner.scan(inBufferPos, inBufferBody, [&](const char *b, const char *e, uint64_t hash) {
+            handleResponseLine(b, e, hash);
+          }));
+        }
+
+        if(response.getConsumed() > maximalDownloaded || inflated > maximalDownloaded) {
+          std::cerr << "File was too large: " << searchFront.front() << std::endl;
+          handleEnd(io, finish);
+          return;
+        }
+
+        if(!response.isComplete()) break;
+
+        if(!finishResponse() || searchFront.empty()) {
+          handleEnd(io, finish);
+          return;
+        }
+
+        if(pace.getCooldown() == 0 && queueRequests()) sendRequests(io);
       }
+
+      if(inBufferFill == inBuffer + inBufferSize) {
+        if(inBufferPos != inBuffer) {
+          memmove(inBuffer, inBufferPos, inBufferFill - inBufferPos);
+
+          inBufferBody -= inBufferPos - inBuffer;
+          inBufferFill -= inBufferPos - inBuffer;
+          inBufferPos = inBuffer;
+        } else if(!growInput()) {
+          // Yes, this looses data in very long lines.
+          if(inBufferBody == inBuffer) {
+            std::cerr << hostname << ": header line too long" << std::endl;
+            handleEnd(io, finish);
+            return;
+          }
+
+          memmove(inBuffer, inBufferBody, inBufferFill - inBufferBody);
+          inBufferFill -= inBufferBody - inBuffer;
+          inBufferPos = inBufferBody = inBuffer;
+          lineScanner.reset();
+        }
+      }
+
+      receive(io);
     }
 
-    template<class A, class M, class D, class F> void handleError(const A &add, const M &, const D &del, const F &finish) {
-      handleEnd(add, del, finish);
+    template<class F> void handleOutput(IoBackend &io, int64_t len, const F &finish) {
+      sending = false;
+
+      if(len < 0) {
+        std::cerr << hostname << ": write failed: " << std::string(strerror(-len)) << std::endl;
+        recordFailure();
+        handleEnd(io, finish);
+        return;
+      }
+
+      outBufferPos += len;
+      sendRequests(io);
     }
 
-    template<class A, class D, class F> void handleEnd(const A &add, const D &del, const F &finish) {
-      if(socket) {
-        finishRequest();
-        closeSocket(del);
+    template<class F> void handleEnd(IoBackend &io, const F &finish) {
+      if(connection) {
+        // A failed request is not repeated, unless it was only waiting in the pipeline.
+        if(requestsInFlight && (response.isStarted() || !responsesOnConnection)) finishRequest();
+        closeSocket(io);
       }
 
       if(searchFront.empty()) {
@@ -202,55 +467,85 @@ class Domain {
         return;
       }
 
-      if(cooldownMilliseconds == 0) {
-        openSocket(add);
-        startRequest();
+      if(pace.getCooldown() == 0) {
+        openSocket(io);
+        queueRequests();
       }
     }
 
-    template<class A, class M, class D, class F> void handleLoop(const A &add, const M &mod, const D &del, const F &finish) {
-      timeval now;
-      gettimeofday(&now, 0);
-
-      if(!socket && !searchFront.empty()) {
-        if(static_cast<uint64_t>(1000 * (now.tv_sec - lastActivity.tv_sec) + (now.tv_usec - lastActivity.tv_usec) / 1000)
-            > cooldownMilliseconds) {
-          openSocket(add);
-          startRequest();
+    // No address answered in time. The request stays for a retry after a pause,
+    // unless the host failed too often and is given up.
+    template<class F> void handleConnectFailure(IoBackend &io, const F &finish) {
+      uint64_t now = monotonicMilliseconds();
+      if(connectSeconds) connectFailuresTotal->add();
 
-          gettimeofday(&lastActivity, 0);
-        }
-      } else if(now.tv_sec - lastActivity.tv_sec > 60) {
-        handleError(add, mod, del, finish);
-        gettimeofday(&lastActivity, 0);
-      }
-    }
+      recordFailure();
+      closeSocket(io);
+      lastActivity = now;
 
-    template<class A, class M, class D, class F> void handleOutput(const A &add, const M &mod, const D &del, const F &finish) {
-      assert(outBufferPos != outBufferFill);
+      if(++connectFailures >= MAX_CONNECT_FAILURES) {
+        std::cerr << hostname << ": unreachable, giving up" << std::endl;
+        if(connectSeconds) unreachableHosts->add();
 
-      ssize_t len = write(socket, outBufferPos, outBufferFill - outBufferPos);
-      if(len < 0) {
-        std::cerr << hostname << ": write failed: " << std::string(strerror(errno)) << std::endl;
-        handleEnd(add, del, finish);
+        searchFront.clear();
+        handleEnd(io, finish);
         return;
       }
 
-      outBufferPos += len;
+      notBefore = now + (CONNECT_BACKOFF_MILLISECONDS << (connectFailures - 1));
+    }
 
-      if(outBufferPos == outBufferFill) mod(socket, true, false);
+    // monotonic time at which handleLoop() has something to do
+    uint64_t getWakeup() const {
+      if(connection && !connected) return nextAddress < addresses.size()? std::min(nextAttemptAt, connectDeadline): connectDeadline;
+      if(!requestsInFlight && !searchFront.empty()) return std::max(lastActivity + pace.getCooldown(), notBefore);
+      return lastActivity + IDLE_TIMEOUT_MILLISECONDS;
+    }
+
+    template<class F> void handleLoop(IoBackend &io, const F &finish) {
+      uint64_t now = monotonicMilliseconds();
+
+      if(connection && !connected) {
+        if(now >= connectDeadline) {
+          handleConnectFailure(io, finish);
+        } else if(now >= nextAttemptAt && nextAddress < addresses.size()) {
+          // the next address joins the race, the earlier attempts keep going
+          attempts.push_back(connection);
+          connection = io.connect(ioSlot, addresses[nextAddress++]);
+          nextAttemptAt = now + CONNECT_STAGGER_MILLISECONDS;
+        }
+      } else if(!requestsInFlight && !searchFront.empty()) {
+        if(now >= std::max(lastActivity + pace.getCooldown(), notBefore)) {
+          if(!reserveServer(now)) return;
+
+          if(connection) {
+            // connection kept alive during the cooldown
+            if(queueRequests()) sendRequests(io);
+          } else {
+            openSocket(io);
+            queueRequests();
+          }
+
+          lastActivity = now;
+        }
+      } else if(now >= lastActivity + IDLE_TIMEOUT_MILLISECONDS) {
+        handleEnd(io, finish);
+        lastActivity = now;
+      }
     }
 
     struct ReportSum {
-      uint64_t reportDownloaded, reportDownloadedNew, remainingFetches, searchFrontSize;
+      uint64_t reportDownloaded, reportDownloadedNew, remainingFetches, searchFrontSize, searchFrontMemory;
     };
 
-    void report(ReportSum *sum) {
-      std::cout << "[" <<
+    // the line of this domain goes to out, if any
+    void report(std::ostream *out, ReportSum *sum) {
+      if(out) *out << "[" <<
         std::setw(10) << reportDownloaded << " b/s | " <<
         std::setw(10) << reportDownloadedNew << " b/s ], " <<
         std::setw(8) << remainingFetches << " | " <<
-        std::setw(8) << searchFront.size() << " -- " <<
+        std::setw(8) << searchFront.size() << " | " <<
+        std::setw(6) << searchFront.getMemory() / 1024 << " kB -- " <<
         hostname << (searchFront.empty()? "": searchFront.front())
         << std::endl;
 
@@ -259,6 +554,7 @@ class Domain {
         sum->reportDownloadedNew += reportDownloadedNew;
         sum->remainingFetches += remainingFetches;
         sum->searchFrontSize += searchFront.size();
+        sum->searchFrontMemory += searchFront.getMemory();
       }
 
       reportDownloaded = 0;
@@ -277,7 +573,9 @@ class Domain {
       ++s;
       for(e = s; e != url.end() && *e != '/'; ++e);
 
-      return std::string(s, e);
+      std::string host(s, e);
+      if(!normalizeHost(host)) throw std::runtime_error("Invalid port: " + url);
+      return host;
     }
 
     static std::string extractPath(const std::string &url) {
@@ -296,207 +594,652 @@ class Domain {
     }
 
   private:
-    static const int BUFFER_SIZE = 1024 * 64;
-
+    static const uint64_t INITIAL_RESPONSE_SIZE = 16 * 1024;
+    static const int MAX_PIPELINE_DEPTH = 16;
+    static const uint64_t IDLE_TIMEOUT_MILLISECONDS = 60000;
+    static const uint64_t MIN_FINGERPRINT_LINES = 16;
+    static const uint64_t HOST_LINES = 8192;
+    static const uint64_t LEARNED_PAGES = 2;
+    static const uint64_t SECOND_PAGE = 0x5bd1e9955bd1e995ull;
+    static const uint64_t CONNECT_STAGGER_MILLISECONDS = 250;
+    static const uint64_t CONNECT_BACKOFF_MILLISECONDS = 10000;
+    static const uint64_t MAX_CONNECT_FAILURES = 3;
+    static const size_t CONDITIONAL_LENGTH = 2 * 24 + UrlMetadataStore::MAX_ETAG + HttpResponse::DATE_LENGTH;
+
+    // hostname includes a port other than 80
     std::string hostname;
-    uint32_t ip;
+    std::string dnsName;
+    uint16_t port;
+    std::vector<SocketAddress> addresses;
 
-    uint64_t cooldownMilliseconds;
-    uint64_t nextFetchTime;
+    // cooldown and requests in flight
+    HostPace pace;
     uint64_t remainingFetches;
     uint64_t recursionMode;
-    std::string outputPath;
 
-    DomainStream *output;
-    std::list<std::string> searchFront;
+    // new lines of the page being received, written as one record when it ends
+    OutputLog *output;
+    std::string page;
+    bool recording;
+    PathFrontier searchFront;
     bool robotsTxtActive;
     bool robotsTxtRelevant;
-    PrefixSet robotsTxt;
+    RobotsRules robotsTxt;
     PostfixSet *ignoreList;
 
-    int socket;
+    uint64_t ioSlot;
+    uint64_t connection;
+    bool connected, receiving, sending;
+
+    // While connecting, connection is the newest attempt and attempts holds the
+    // older ones still running. The next address is tried at nextAttemptAt.
+    std::vector<uint64_t> attempts;
+    size_t nextAddress;
+    uint64_t nextAttemptAt, connectDeadline;
+    uint64_t connectTimeoutMilliseconds;
+    uint64_t connectFailures;
 
+    // [inBufferPos, inBufferBody) is decoded body, [inBufferBody, inBufferFill) still raw
+    BufferPool *buffers;
     char *inBuffer;
+    size_t inBufferSize;
     char *inBufferPos;
+    char *inBufferBody;
     char *inBufferFill;
+    LineScanner lineScanner;
+    LinkScanner linkScanner;
+
+    // the <base> of the page, empty if it has none; and the link being resolved
+    std::string baseHost, basePath;
+    std::string linkHost, linkPath;
+    HttpResponse response;
+
+    // the headers of the response have been looked at, and its body is not wanted
+    bool headersChecked, skipping;
+
+    // A compressed body is decompressed into the text buffer, [textPos, textFill)
+    // is its text not yet split into lines. Both stay with the connection.
+    bool inflating;
+    Inflater inflater;
+    char *textBuffer;
+    size_t textBufferSize;
+    char *textPos;
+    char *textFill;
+    uint64_t inflated;
+
+    // the first requestsInFlight paths of the search front have been sent
+    uint64_t requestsInFlight;
+    uint64_t responsesOnConnection;
+
+    // slowly decaying maximum of the response sizes, to size the input buffer
+    uint64_t responseSize;
 
     char *outBuffer;
+    size_t outBufferSize;
     char *outBufferPos;
     char *outBufferFill;
 
-    timeval lastActivity;
+    uint64_t lastActivity;
+
+    BlockedBloomSet *seenUrls;
+    ScalableBloomSet *seenLines;
+    HostFrontier *hostFrontier;
 
-    BloomSet *seenUrls;
-    BloomSet *seenLines;
+    // another host on the same server has it reserved until notBefore
+    IpCooldown *ipCooldown;
+    uint64_t notBefore;
+
+    // Fingerprint of the page being received, of its lines which are not
+    // boilerplate: lines of two earlier pages of the host, kept in hostLines
+    // (as hash, and hash ^ SECOND_PAGE once on the second page). The first
+    // LEARNED_PAGES pages only teach it. Links wait in pageLinks until the
+    // page is complete and known not to be a near-duplicate.
+    SimHashIndex *pageIndex;
+    SimHash *fingerprint;
+    BlockedBloomSet *hostLines;
+    uint64_t hostPages;
+    std::vector<uint64_t> pageLines;
+    std::vector<std::pair<std::string, LinkScanner::Kind>> pageLinks;
+
+    // what was known about a URL, and the hash of all lines of the page being received
+    UrlMetadataStore *urlMetadata;
+    bool recrawl;
+    UrlMetadata known;
+    uint64_t contentHash;
+
+    Shards *shards;
 
     uint64_t reportDownloaded;
     uint64_t reportDownloadedNew;
 
-    uint64_t currentDownloaded;
+    // set by setMetrics(), connectSeconds stays null without
+    Histogram *connectSeconds, *firstByteSeconds, *fetchSeconds;
+    Counter *receivedBytes, *newBytes, *pages, *skippedResponses, *unchangedPages, *compressedBytes, *inflatedBytes;
+    Counter *connectFailuresTotal, *unreachableHosts;
+    uint64_t connectStarted, requestStarted;
+
     uint64_t maximalUrlLength;
     uint64_t maximalDownloaded;
+    uint64_t maximalSkipped;
 
-    template<class A> void openSocket(const A &add) {
-      assert(!socket);
+    void resetFingerprint() {
+      if(fingerprint) fingerprint->reset();
+      pageLines.clear();
+      pageLinks.clear();
+    }
 
-      sockaddr_in addr { AF_INET, 80 << 8, { ip }};
-      socket = ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
-      connect(socket, reinterpret_cast<sockaddr *>(&addr), sizeof(addr));
+    // the links of the page, unless it is a near-duplicate; its lines become known to the host
+    void finishFingerprint() {
+      bool duplicate = hostPages >= LEARNED_PAGES && fingerprint->getLines() >= MIN_FINGERPRINT_LINES &&
+        pageIndex->check(fingerprint->get());
+      if(!duplicate) {
+        for(auto &link: pageLinks) handleLink(link.first.data(), link.first.data() + link.first.length(), link.second);
+      }
 
-      inBufferPos = inBufferFill = inBuffer;
-      outBufferPos = outBufferFill = outBuffer;
+      if(!pageLines.empty()) {
+        std::sort(pageLines.begin(), pageLines.end());
+        pageLines.erase(std::unique(pageLines.begin(), pageLines.end()), pageLines.end());
+        for(uint64_t hash: pageLines) {
+          if(hostLines->insert(hash)) hostLines->insert(hash ^ SECOND_PAGE);
+        }
+        ++hostPages;
+      }
+
+      resetFingerprint();
+    }
 
-      add(socket, false, true);
+    // the request in flight failed, the host may be overloaded
+    void recordFailure() {
+      if(requestsInFlight) pace.record(monotonicMicroseconds() - requestStarted, true);
     }
 
-    template<class D> void closeSocket(const D &del) {
-      assert(socket);
+    // false if the next fetch has to wait for another host on the same server
+    bool reserveServer(uint64_t now) {
+      if(!ipCooldown || !pace.getCooldown()) return true;
 
-      del(socket, false, false);
-      close(socket);
-      socket = 0;
+      uint64_t start = ipCooldown->reserve(addresses.front().getServer(), now, pace.getCooldown());
+      if(start == now) return true;
+
+      notBefore = start;
+      return false;
     }
 
-    void startRequest() {
-      assert(outBufferPos == outBufferFill);
-      assert(!searchFront.empty());
+    void openSocket(IoBackend &io) {
+      assert(!connection);
+
+      uint64_t now = monotonicMilliseconds();
+      nextAddress = 0;
+      connection = io.connect(ioSlot, addresses[nextAddress++]);
+      nextAttemptAt = now + CONNECT_STAGGER_MILLISECONDS;
+      connectDeadline = now + connectTimeoutMilliseconds;
+      if(connectSeconds) connectStarted = monotonicMicroseconds();
+      connected = receiving = sending = false;
 
+      inBufferSize = std::min<uint64_t>(responseSize, BufferPool::MAX_SIZE);
+      inBuffer = buffers->allocate(inBufferSize);
+      outBufferSize = BufferPool::MIN_SIZE;
+      outBuffer = buffers->allocate(outBufferSize);
+
+      inBufferPos = inBufferBody = inBufferFill = inBuffer;
       outBufferPos = outBufferFill = outBuffer;
+      headersChecked = skipping = inflating = false;
+      textBuffer = 0;
+      inflated = 0;
+      contentHash = HASH_SEED;
+      lineScanner.reset();
+      linkScanner.reset();
+      baseHost.clear();
+      basePath.clear();
+      response.reset();
+      page.clear();
+      recording = false;
+      resetFingerprint();
+      requestsInFlight = 0;
+      responsesOnConnection = 0;
+    }
+
+    void closeSocket(IoBackend &io) {
+      assert(connection);
+
+      io.close(connection);
+      for(auto a: attempts) io.close(a);
+      attempts.clear();
+      connection = 0;
+      requestsInFlight = 0;
+
+      buffers->release(inBuffer, inBufferSize);
+      buffers->release(outBuffer, outBufferSize);
+      inBuffer = outBuffer = 0;
+
+      if(textBuffer) buffers->release(textBuffer, textBufferSize);
+      textBuffer = 0;
+      inflater.release();
+    }
+
+    // moves the input to a buffer twice as large, false if it is as large as it gets
+    bool growInput() {
+      if(inBufferSize >= BufferPool::MAX_SIZE) return false;
+
+      size_t size = inBufferSize * 2;
+      char *b = buffers->allocate(size);
+      memcpy(b, inBuffer, inBufferFill - inBuffer);
+
+      inBufferPos = b + (inBufferPos - inBuffer);
+      inBufferBody = b + (inBufferBody - inBuffer);
+      inBufferFill = b + (inBufferFill - inBuffer);
+
+      buffers->release(inBuffer, inBufferSize);
+      inBuffer = b;
+      inBufferSize = size;
+
+      responseSize = std::max<uint64_t>(responseSize, size);
+      return true;
+    }
+
+    // replaces the empty output buffer by one of at least size bytes
+    bool growOutput(size_t size) {
+      if(size > BufferPool::MAX_SIZE) return false;
+
+      buffers->release(outBuffer, outBufferSize);
+      outBufferSize = size;
+      outBuffer = outBufferPos = outBufferFill = buffers->allocate(outBufferSize);
+      return true;
+    }
+
+    void receive(IoBackend &io) {
+      if(receiving) return;
+
+      io.receive(connection, inBufferFill, inBuffer + inBufferSize - inBufferFill);
+      receiving = true;
+    }
+
+    // sends whatever queueRequests() put into the output buffer
+    void sendRequests(IoBackend &io) {
+      if(!connected || sending || outBufferPos == outBufferFill) return;
+
+      io.send(connection, outBufferPos, outBufferFill - outBufferPos);
+      sending = true;
+    }
+
+    // sends further paths of the search front (up to the pipeline depth), returns true if any were added
+    bool queueRequests() {
+      // robots.txt has to be known before anything else is requested
+      uint64_t depth = robotsTxtActive? 1: pace.getDepth();
+      if(requestsInFlight >= depth || requestsInFlight >= searchFront.size()) return false;
+
+      if(outBufferPos == outBufferFill) outBufferPos = outBufferFill = outBuffer;
+
+      uint64_t queued = requestsInFlight;
+      if(!queued) requestStarted = monotonicMicroseconds();
+      while(requestsInFlight < depth && requestsInFlight < searchFront.size()) {
+        const std::string &path = searchFront.peek(requestsInFlight);
+        bool conditional = recrawl && !robotsTxtActive && urlMetadata->lookup(urlKey(path), known);
+        size_t length = path.length() + hostname.length() + 96;
+        if(conditional) length += CONDITIONAL_LENGTH;
+
+        if(outBuffer + outBufferSize - outBufferFill < static_cast<ssize_t>(length) &&
+            (requestsInFlight || sending || !growOutput(length))) {
+          if(requestsInFlight || sending) break;
+
+          std::cerr << "URL too long: " << hostname << path << std::endl;
+          searchFront.pop_front();
+          continue;
+        }
+
+        for(const char *s = "GET "; (*outBufferFill = *s++); outBufferFill++);
+        for(const char *s = path.c_str(); (*outBufferFill = *s++); outBufferFill++);
+        for(const char *s = " HTTP/1.1\r\n"; (*outBufferFill = *s++); outBufferFill++);
+        for(const char *s = "Host: "; (*outBufferFill = *s++); outBufferFill++);
+        for(const char *s = hostname.c_str(); (*outBufferFill = *s++); outBufferFill++);
+        if(conditional && !known.etag.empty()) {
+          for(const char *s = "\r\nIf-None-Match: "; (*outBufferFill = *s++); outBufferFill++);
+          for(const char *s = known.etag.c_str(); (*outBufferFill = *s++); outBufferFill++);
+        }
+        if(conditional && known.lastModified) {
+          char date[HttpResponse::DATE_LENGTH + 1];
+          HttpResponse::formatDate(known.lastModified, date);
+          for(const char *s = "\r\nIf-Modified-Since: "; (*outBufferFill = *s++); outBufferFill++);
+          for(const char *s = date; (*outBufferFill = *s++); outBufferFill++);
+        }
+        for(const char *s = "\r\nAccept-Encoding: gzip, deflate\r\n\r\n"; (*outBufferFill = *s++); outBufferFill++);
+
+        // std::cerr << "Fetching: " << path << std::endl;
+
+        ++requestsInFlight;
+      }
+
+      return requestsInFlight != queued;
+    }
+
+    // returns false if the server closes the connection now
+    bool finishResponse() {
+      int status = response.getStatus();
+      bool notModified = status == 304;
+      if(skipping && !notModified && connectSeconds) skippedResponses->add();
+      if(urlMetadata && !robotsTxtActive) rememberFetch(notModified);
+
+      // a pipelined response waiting behind this one starts now
+      uint64_t now = monotonicMicroseconds();
+      pace.record(now - requestStarted, status == 429 || status >= 500);
+      if(connectSeconds) {
+        fetchSeconds->record(now - requestStarted);
+        pages->add();
+      }
+      requestStarted = now;
+
+      finishRequest();
+      --requestsInFlight;
+      ++responsesOnConnection;
+
+      responseSize = std::max(response.getConsumed(), responseSize - responseSize / 8);
+
+      // an unterminated last line is dropped
+      inBufferPos = inBufferBody;
+      textPos = textFill = textBuffer;
+      inflated = 0;
+      contentHash = HASH_SEED;
+      headersChecked = skipping = inflating = false;
+      lineScanner.reset();
+      linkScanner.reset();
+      baseHost.clear();
+      basePath.clear();
+
+      bool keepAlive = response.isKeepAlive();
+      response.reset();
+      return keepAlive;
+    }
+
+    // Updates the store after a complete response. A page not modified since
+    // the last fetch is not recorded again when recrawling.
+    void rememberFetch(bool notModified) {
+      int status = response.getStatus();
+      if(!notModified && (skipping || status < 200 || status >= 300)) return;
+
+      uint64_t key = urlKey(searchFront.front());
+      bool seen = urlMetadata->lookup(key, known);
+      uint32_t now = time(0);
+
+      if(notModified) {
+        if(!seen) return;
+
+        known.fetched = now;
+        urlMetadata->update(key, known);
+        if(connectSeconds) unchangedPages->add();
+        return;
+      }
 
-      for(const char *s = "GET "; (*outBufferFill = *s++); outBufferFill++);
-      for(const char *s = searchFront.front().c_str(); (*outBufferFill = *s++); outBufferFill++);
-      for(const char *s = " HTTP/1.1\r\n"; (*outBufferFill = *s++); outBufferFill++);
-      for(const char *s = "Host: "; (*outBufferFill = *s++); outBufferFill++);
-      for(const char *s = hostname.c_str(); (*outBufferFill = *s++); outBufferFill++);
-      for(const char *s = "\r\nConnection: close\r\n\r\n"; (*outBufferFill = *s++); outBufferFill++);
+      if(recrawl && seen && known.contentHash == contentHash) {
+        recording = false;
+        page.clear();
+        if(connectSeconds) unchangedPages->add();
+      }
 
-      // std::cerr << "Fetching: " << searchFront.front() << std::endl;
-      output->handleRequest(hostname, searchFront.front().c_str(), searchFront.front().c_str() + searchFront.front().length());
-      currentDownloaded = 0;
+      known.etag = response.getEtag();
+      known.lastModified = response.getLastModified();
+      known.fetched = now;
+      known.contentHash = contentHash;
+      urlMetadata->update(key, known);
+    }
+
+    uint64_t urlKey(const std::string &path) const {
+      return hashWord(hashBytes(hostname.data(), hostname.length()), hashBytes(path.data(), path.length()));
     }
 
     void finishRequest() {
       assert(!searchFront.empty());
 
+      if(recording) {
+        output->append(hostname, searchFront.front(), page.data(), page.data() + page.length());
+        page.clear();
+        recording = false;
+      }
+
+      if(fingerprint) finishFingerprint();
+
       searchFront.pop_front();
 
       if(robotsTxtActive) {
         robotsTxtActive = false;
 
-        searchFront.remove_if([&](const std::string &url) { return robotsTxt.matches(url); });
+        if(robotsTxt.size()) searchFront.removeIf([&](const std::string &url) { return robotsTxt.disallows(url); });
       }
     }
 
-    void handleLine(const char *b, const char *e) {
-      if(seenLines->insert(b, e - b)) return;
-
-      reportDownloadedNew += e - b;
-      output->handleLine(b, e);
+    // links are searched in the body as it comes, regardless of lines
+    void scanLinks(const char *b, const char *e) {
+      if(robotsTxtActive || !recursionMode) return;
 
-      if(!recursionMode) return;
-      if(!remainingFetches) return;
+      linkScanner.scan(b, e, [&](const char *b, const char *e, LinkScanner::Kind kind) {
+        if(fingerprint) {
+          pageLinks.push_back(std::make_pair(std::string(b, e), kind));
+        } else {
+          handleLink(b, e, kind);
+        }
+      });
+    }
 
-      // searching for:
-      // h?ref=['"]([^"']+)['"]
-      //   src=['"]([^"']+)['"]
-      // l?ink=['"]([^"']+)['"]
-      //   0123   4       5   6
+    // the text buffer stays with the connection once it was needed
+    void startInflating() {
+      if(!textBuffer) {
+        textBufferSize = BufferPool::MAX_SIZE;
+        textBuffer = buffers->allocate(textBufferSize);
+      }
 
-      for(const char *s = b; s < e - 7; ++s) {
-        if(*reinterpret_cast<const uint32_t *>(s) != *reinterpret_cast<const uint32_t *>("ref=") &&
-           *reinterpret_cast<const uint32_t *>(s) != *reinterpret_cast<const uint32_t *>("src=") &&
-           *reinterpret_cast<const uint32_t *>(s) != *reinterpret_cast<const uint32_t *>("ink=")) continue;
+      textPos = textFill = textBuffer;
+      inflater.reset();
+      inflating = true;
+      inflated = 0;
+    }
 
-        s += 4;
+    // Decompresses [b, e) into the text buffer and handles the text like an
+    // uncompressed body. False if the data is corrupt.
+    bool inflateBody(const char *b, const char *e) {
+      if(connectSeconds) compressedBytes->add(e - b);
+
+      while(b != e) {
+        if(textFill == textBuffer + textBufferSize) {
+          if(textPos == textBuffer) {
+            // Yes, this looses data in very long lines.
+            textPos = textFill = textBuffer;
+            lineScanner.reset();
+          } else {
+            memmove(textBuffer, textPos, textFill - textPos);
+            textFill -= textPos - textBuffer;
+            textPos = textBuffer;
+          }
+        }
 
-        if(*s != '\'' && *s != '"') continue;
+        char *text = textFill;
+        if(!inflater.inflate(b, e, textFill, textBuffer + textBufferSize)) return false;
 
-        const char *urlBegin = s + 1;
-        const char *urlEnd = urlBegin;
+        inflated += textFill - text;
+        if(connectSeconds) inflatedBytes->add(textFill - text);
 
-        while(urlEnd != e && *urlEnd != *s) ++urlEnd;
-        if(urlEnd == e) return;
-        if(urlEnd == urlBegin) return;
-        if(!remainingFetches) return;
+        scanLinks(text, textFill);
+        textPos = const_cast<char *>(lineScanner.scan(textPos, textFill, [&](const char *b, const char *e, uint64_t hash) {
+          handleResponseLine(b, e, hash);
+        }));
 
-        handleUrl(urlBegin, urlEnd);
+        if(inflated > maximalDownloaded) break;
       }
-    }
 
-    void handleUrl(const char *b, const char *e) {
-      assert(b != e);
-      std::string url(b, e);
+      return true;
+    }
 
-      // std::cout << "URL found: " << url << std::endl;
-      // std::cout << "relative to: " << searchFront.front() << std::endl;
+    // false if the body is of no use; redirects are followed from here
+    bool acceptResponse() {
+      int status = response.getStatus();
 
-      if(url.substr(0, 7) == "mailto:") return;
-      if(url.substr(0, 11) == "javascript:") return;
-      if(url.substr(0, 8) == "https://") return;
-      if(url.substr(0, 7) == "http://") {
-        if(url.length() < 8) return;
-        if(url.substr(7, 7 + hostname.length()) != hostname) return;
-        url = url.substr(7 + hostname.length());
+      if(status >= 300 && status < 400) {
+        const std::string &location = response.getLocation();
+        if(!robotsTxtActive && !location.empty()) handleLink(location.data(), location.data() + location.length(), LinkScanner::LINK);
+        return false;
       }
 
-      size_t anchor = url.find('#');
-      if(anchor != std::string::npos) url = url.substr(0, anchor);
+      // status 0 is a response without status line, taken as it is
+      return (status == 0 || (status >= 200 && status < 300)) && response.isText() &&
+        response.getEncoding() != HttpResponse::UNSUPPORTED;
+    }
 
-      std::string base;
+    void handleResponseLine(const char *b, const char *e, uint64_t hash) {
+      if(robotsTxtActive) handleRobotsTxtLine(b, e);
+      if(!robotsTxtActive) handleLine(b, e, hash);
+    }
 
-      if(*b == '/') {
-        base = "/";
-        url = url.substr(1);
-      } else {
-        base = searchFront.front();
-        base.erase(base.rfind('/') + 1);
+    void handleLine(const char *b, const char *e, uint64_t hash) {
+      if(fingerprint) {
+        if(!hostLines->contains(hash ^ SECOND_PAGE)) fingerprint->add(hash);
+        pageLines.push_back(hash);
       }
 
-      while(url.length() > 3 && url[0] == '.' && url[1] == '.' && url[2] == '/') {
-        if(base != "/") base.erase(base.rfind('/', base.length() - 2) + 1);
-        url = url.substr(3);
+      contentHash = hashWord(contentHash, hash);
+      if(seenLines->insert(hash)) return;
+      if(shards) shards->forwardLine(hash);
+
+      reportDownloadedNew += e - b;
+      if(connectSeconds) newBytes->add(e - b);
+      page.append(b, e);
+    }
+
+    void handleLink(const char *b, const char *e, LinkScanner::Kind kind) {
+      if(!resolveLink(b, e)) return;
+
+      if(kind == LinkScanner::BASE) {
+        baseHost = linkHost;
+        basePath = linkPath;
+        return;
       }
 
-      // std::cout << "base: " << base << std::endl;
-      // std::cout << "absolute: " << base + url << std::endl;
+      if(linkPath.length() > maximalUrlLength) return;
 
-      url = base + url;
+      if(strcasecmp(linkHost.c_str(), hostname.c_str())) {
+        if(hostFrontier && !ignoreList->matches(linkPath)) hostFrontier->discover(linkHost, linkPath);
+        return;
+      }
 
-      if(url.length() > maximalUrlLength) return;
-      if(robotsTxt.matches(url)) return;
-      if(seenUrls->contains(url)) return;
-      seenUrls->insert(url);
+      if(!remainingFetches) return;
+      if(robotsTxt.disallows(linkPath)) return;
+      if(seenUrls->contains(linkPath)) return;
+      seenUrls->insert(linkPath);
 
-      if(ignoreList->matches(url)) return;
+      if(ignoreList->matches(linkPath)) return;
 
-      searchFront.push_back(url);
+      searchFront.push_back(linkPath);
       assert(remainingFetches > 0);
       --remainingFetches;
     }
 
+    // Resolves the link [b, e) against the page (or its <base>) into linkHost
+    // and linkPath, false if it is not an http link. Both strings are reused,
+    // so once they have grown this allocates nothing.
+    bool resolveLink(const char *b, const char *e) {
+      while(b != e && isspace(static_cast<unsigned char>(*b))) ++b;
+      while(e != b && isspace(static_cast<unsigned char>(e[-1]))) --e;
+      e = std::find(b, e, '#');
+      if(b == e) return false;
+
+      const char *authority = 0;
+      if(e - b >= 7 && !strncasecmp(b, "http://", 7)) {
+        authority = b + 7;
+      } else if(e - b >= 2 && b[0] == '/' && b[1] == '/') {
+        authority = b + 2;
+      } else {
+        // any other scheme: https:, mailto:, javascript:, ...
+        const char *s = b;
+        while(s != e && (isalnum(static_cast<unsigned char>(*s)) || *s == '+' || *s == '-' || *s == '.')) ++s;
+        if(s != e && *s == ':') return false;
+      }
+
+      if(authority) {
+        const char *p = authority;
+        while(p != e && *p != '/' && *p != '?') ++p;
+
+        linkHost.assign(authority, p);
+        for(auto &c: linkHost) c = tolower(c);
+
+        // no user names, IPv6 literals or other oddities
+        if(linkHost.empty() || linkHost[0] == ':' || linkHost.find_first_not_of("abcdefghijklmnopqrstuvwxyz0123456789-.:") != std::string::npos) return false;
+        if(!normalizeHost(linkHost)) return false;
+
+        linkPath.assign(p != e && *p == '/'? "": "/");
+        linkPath.append(p, e);
+      } else {
+        const std::string &base = basePath.empty()? searchFront.front(): basePath;
+        linkHost.assign(baseHost.empty()? hostname: baseHost);
+
+        size_t query = base.find('?');
+        if(*b == '/') {
+          linkPath.assign(b, e);
+        } else if(*b == '?') {
+          linkPath.assign(base, 0, query);
+          linkPath.append(b, e);
+        } else {
+          linkPath.assign(base, 0, base.rfind('/', query) + 1);
+          linkPath.append(b, e);
+        }
+      }
+
+      removeDotSegments(linkPath);
+      return true;
+    }
+
+    // resolves "." and ".." segments of an absolute path in place, the query stays as it is
+    static void removeDotSegments(std::string &path) {
+      size_t end = std::min(path.find('?'), path.length());
+      size_t out = 0;
+
+      for(size_t in = 0; in < end;) {
+        size_t next = std::min(path.find('/', in + 1), end);
+        size_t length = next - in - 1;
+
+        if(length == 1 && path[in + 1] == '.') {
+          if(next == end) path[out++] = '/';
+        } else if(length == 2 && path[in + 1] == '.' && path[in + 2] == '.') {
+          while(out && path[--out] != '/');
+          if(next == end) path[out++] = '/';
+        } else {
+          memmove(&path[out], &path[in], next - in);
+          out += next - in;
+        }
+
+        in = next;
+      }
+
+      path.erase(out, end - out);
+    }
+
     void handleRobotsTxtLine(const char *b, const char *e) {
       if(b == e) return;
 
-      output->handleLine(b, e);
+      page.append(b, e);
+
+      // comments and trailing white space are not part of the value
+      const char *end = std::find(b, e, '#');
+      const char *c = std::find(b, end, ':');
+      if(c == end) return;
 
-      const char *c = b;
-      while(c != e && *c++ != ':');
-      --c;
-      if(*c != ':') return;
+      std::string key(b, c);
+      key.erase(key.find_last_not_of(" \t") + 1);
+      std::transform(key.begin(), key.end(), key.begin(), ::tolower);
 
-      if(*b == 'U' || *b == 'u') {
+      while(++c, c != end && (*c == ' ' || *c == '\t'));
+      while(end != c && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\n' || end[-1] == '\r')) --end;
+
+      if(key == "user-agent") {
         // User-agent: *
         // User-agent: agent
 
-        while(++c, c != e && *c == ' ');
-        robotsTxtRelevant = c != e && *c == '*';
-      } else if(robotsTxtRelevant && (*b == 'D' || *b == 'd')) {
-        // Disallow: /path
+        robotsTxtRelevant = c != end && *c == '*';
+      } else if(robotsTxtRelevant && key == "crawl-delay") {
+        // Crawl-delay: 2.5 (seconds)
 
-        while(--e, *e == '\n' || *e == '\r');
-        while(++c, *c == ' ' || *c == '\t');
+        double seconds = strtod(std::string(c, end).c_str(), 0);
+        if(seconds > 0) pace.setFloor(seconds * 1000);
+      } else if(robotsTxtRelevant && (key == "disallow" || key == "allow")) {
+        // Disallow: /path
+        // Allow: /path/*.html$
 
-        robotsTxt.insert(std::string(c, e + 1));
+        robotsTxt.insert(std::string(c, end), key == "allow");
       }
     }
 
@@ -0,0 +1,191 @@
+#ifndef EPOLLBACKEND_H
+#define EPOLLBACKEND_H
+
+#include "IoBackend.h"
+
+#include <vector>
+#include <stdexcept>
+#include <string>
+#include <cassert>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+// Completions on top of edge-triggered epoll: every socket is registered
+// once for input and output, readiness is remembered per socket and
+// outstanding operations are carried out as soon as it allows.
+class EpollBackend: public IoBackend {
+  public:
+    EpollBackend(): sequence(0) {
+      handle = epoll_create1(0);
+      if(handle < 0) throw std::runtime_error("epoll_create1 failed: " + std::string(strerror(errno)));
+    }
+
+    ~EpollBackend() {
+      ::close(handle);
+    }
+
+    uint64_t connect(uint64_t slot, const SocketAddress &addr) {
+      int fd = ::socket(addr.getFamily(), SOCK_STREAM | SOCK_NONBLOCK, 0);
+      if(fd < 0) {
+        uint64_t connection = makeConnection(++sequence, -1);
+        completed.push_back(IoCompletion { slot, connection, IO_CONNECT, -errno });
+        return connection;
+      }
+
+      if(sockets.size() <= static_cast<size_t>(fd)) sockets.resize(fd + 1);
+      Socket &s = sockets[fd];
+      s = Socket();
+      s.connection = makeConnection(++sequence, fd);
+      s.slot = slot;
+      s.connecting = true;
+
+      epoll_event ev { EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET, { .fd = fd }};
+      if((::connect(fd, addr.get(), addr.getLength()) < 0 && errno != EINPROGRESS) ||
+          epoll_ctl(handle, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        s.connecting = false;
+        completed.push_back(IoCompletion { slot, s.connection, IO_CONNECT, -errno });
+      }
+
+      return s.connection;
+    }
+
+    void receive(uint64_t connection, char *b, size_t n) {
+      Socket &s = get(connection);
+      assert(!s.receiveSize);
+
+      s.receiveBuffer = b;
+      s.receiveSize = n;
+      if(s.readable) schedule(connectionFd(connection));
+    }
+
+    void send(uint64_t connection, const char *b, size_t n) {
+      Socket &s = get(connection);
+      assert(!s.sendSize);
+
+      s.sendBuffer = b;
+      s.sendSize = n;
+      if(s.writable) schedule(connectionFd(connection));
+    }
+
+    void close(uint64_t connection) {
+      int fd = connectionFd(connection);
+      if(fd < 0) return;
+
+      // closing also removes it from the epoll set
+      get(connection) = Socket();
+      ::close(fd);
+    }
+
+    void wait(int timeout, std::vector<IoCompletion> &completions) {
+      size_t before = completions.size();
+
+      completions.insert(completions.end(), completed.begin(), completed.end());
+      completed.clear();
+      perform(completions);
+      if(completions.size() != before) timeout = 0;
+
+      epoll_event events[MAX_EVENTS];
+      int n = epoll_wait(handle, events, MAX_EVENTS, timeout);
+
+      for(int i = 0; i < n; ++i) {
+        Socket &s = sockets[events[i].data.fd];
+        if(!s.connection) continue;
+
+        if(events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) s.readable = true;
+        if(events[i].events & (EPOLLOUT | EPOLLHUP | EPOLLERR)) s.writable = true;
+        schedule(events[i].data.fd);
+      }
+
+      perform(completions);
+    }
+
+  private:
+    static const int MAX_EVENTS = 256;
+
+    struct Socket {
+      uint64_t connection;
+      uint64_t slot;
+      bool connecting, readable, writable, scheduled;
+
+      char *receiveBuffer;
+      size_t receiveSize;
+      const char *sendBuffer;
+      size_t sendSize;
+
+      Socket(): connection(0), slot(0), connecting(false), readable(false), writable(false), scheduled(false),
+        receiveBuffer(0), receiveSize(0), sendBuffer(0), sendSize(0) { }
+    };
+
+    int handle;
+    uint64_t sequence;
+    std::vector<Socket> sockets;
+    std::vector<int> ready;
+    std::vector<IoCompletion> completed;
+
+    Socket &get(uint64_t connection) {
+      Socket &s = sockets[connectionFd(connection)];
+      assert(s.connection == connection);
+      return s;
+    }
+
+    void schedule(int fd) {
+      if(sockets[fd].scheduled) return;
+
+      sockets[fd].scheduled = true;
+      ready.push_back(fd);
+    }
+
+    // carries out whatever outstanding operation the readiness allows
+    void perform(std::vector<IoCompletion> &completions) {
+      for(auto fd: ready) {
+        Socket &s = sockets[fd];
+        s.scheduled = false;
+        if(!s.connection) continue;
+
+        if(s.connecting) {
+          if(!s.writable) continue;
+
+          int error = 0;
+          socklen_t len = sizeof(error);
+          getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &len);
+
+          s.connecting = false;
+          completions.push_back(IoCompletion { s.slot, s.connection, IO_CONNECT, -error });
+        }
+
+        if(s.receiveSize && s.readable) {
+          ssize_t len = read(fd, s.receiveBuffer, s.receiveSize);
+
+          if(len < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            s.readable = false;
+          } else {
+            // a short read drained the socket, the next edge will tell about more
+            if(len >= 0 && static_cast<size_t>(len) < s.receiveSize) s.readable = len == 0;
+
+            s.receiveSize = 0;
+            completions.push_back(IoCompletion { s.slot, s.connection, IO_RECEIVE, len < 0? -errno: len });
+          }
+        }
+
+        if(s.sendSize && s.writable) {
+          ssize_t len = ::send(fd, s.sendBuffer, s.sendSize, MSG_NOSIGNAL);
+
+          if(len < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            s.writable = false;
+          } else {
+            if(len >= 0 && static_cast<size_t>(len) < s.sendSize) s.writable = false;
+
+            s.sendSize = 0;
+            completions.push_back(IoCompletion { s.slot, s.connection, IO_SEND, len < 0? -errno: len });
+          }
+        }
+      }
+
+      ready.clear();
+    }
+};
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include <stdint.h>
+#include <string.h>
+
+// 64 bit string hash, consuming the input 8 bytes at a time.
+const uint64_t HASH_SEED = 0x4567779816798165ull;
+
+inline uint64_t hashWord(uint64_t h, uint64_t w) {
+  h = (h ^ w) * 0x9E3779B97F4A7C15ull;
+  return h ^ (h >> 32);
+}
+
+inline uint64_t hashFinish(uint64_t h, uint64_t n) {
+  h ^= n;
+  h ^= h >> 33;
+  h *= 0xFF51AFD7ED558CCDull;
+  h ^= h >> 33;
+  h *= 0xC4CEB9FE1A85EC53ull;
+  h ^= h >> 33;
+  return h;
+}
+
+inline uint64_t hashBytes(const char *str, const size_t n) {
+  uint64_t h = HASH_SEED;
+  const char *e = str + n;
+
+  for(; e - str >= 8; str += 8) {
+    uint64_t w;
+    memcpy(&w, str, 8);
+    h = hashWord(h, w);
+  }
+
+  if(str != e) {
+    uint64_t w = 0;
+    memcpy(&w, str, e - str);
+    h = hashWord(h, w);
+  }
+
+  return hashFinish(h, n);
+}
+
+#endif
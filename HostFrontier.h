@@ -0,0 +1,192 @@
+#ifndef HOSTFRONTIER_H
+#define HOSTFRONTIER_H
+
+#include "BlockedBloomSet.h"
+#include "SeedFile.h"
+
+#include <stdint.h>
+#include <string>
+#include <deque>
+#include <vector>
+#include <unordered_set>
+#include <mutex>
+#include <functional>
+
+// Hosts found in links, shared by all workers. Every host is queued once
+// (with the path of the first link to it) until maxHosts hosts are known;
+// idle workers take their new domains from here, and from the seed file
+// first. Thread-safe.
+class HostFrontier {
+  public:
+    HostFrontier(uint64_t maxHosts): seen(new BlockedBloomSet(maxHosts)), maxHosts(maxHosts), hosts(0), busyWorkers(0), held(false), seeds(0) { }
+
+    ~HostFrontier() {
+      delete seen;
+    }
+
+    // continues with the known hosts of save(), takes ownership of known
+    void restore(BlockedBloomSet *known, uint64_t count) {
+      std::lock_guard<std::mutex> lock(mutex);
+      delete seen;
+      seen = known;
+      hosts = count;
+    }
+
+    // a host crawled anyway (fetch or checkpoint), it still counts against maxHosts
+    void add(const std::string &host) {
+      std::lock_guard<std::mutex> lock(mutex);
+      if(!seen->insert(host)) ++hosts;
+      added.insert(host);
+    }
+
+    // a host queued in a checkpoint, already known and counted
+    void requeue(const std::string &url) {
+      std::lock_guard<std::mutex> lock(mutex);
+      queue.push_back(url);
+    }
+
+    // seeds are handed out before any discovered host, discovery is not over until they are
+    void setSeeds(SeedFile *s) {
+      seeds = s;
+    }
+
+    // hosts for which route(host, path) returns true are left to it (i.e. to
+    // another shard) and not counted; it is called under the lock
+    void setRouter(const std::function<bool(const std::string &, const std::string &)> &route) {
+      router = route;
+    }
+
+    void discover(const std::string &host, const std::string &path) {
+      if(seen->contains(host)) return;
+
+      std::lock_guard<std::mutex> lock(mutex);
+      if(hosts >= maxHosts || seen->insert(host)) return;
+      if(seeds && seeds->contains(host)) return;
+      if(router && router(host, path)) return;
+
+      ++hosts;
+      queue.push_back("http://" + host + path);
+    }
+
+    // Calls f(url) for up to n queued urls and removes them. f runs under the
+    // lock, so a host is always either in getQueue() or already recorded by f.
+    template<class F> void take(size_t n, const F &f) {
+      std::lock_guard<std::mutex> lock(mutex);
+      for(; n && !queue.empty(); queue.pop_front()) {
+        // discovered while its seeds were still to come
+        if(isSeeded(queue.front())) {
+          --hosts;
+          continue;
+        }
+
+        f(static_cast<const std::string &>(queue.front()));
+        --n;
+      }
+    }
+
+    // Calls f(urls) for the seed urls of up to n hosts, like take(). Seed hosts
+    // are crawled in any case, they only count against maxHosts. So every host
+    // stays one domain, they are told apart exactly (never by the filter of
+    // known hosts): the seed file hands out each host once, hosts of fetches
+    // and checkpoints are skipped, and discovered ones only queue until the
+    // seeds are done, then take() drops those seeded. Returns the number of
+    // hosts taken.
+    template<class F> size_t takeSeeds(size_t n, const F &f) {
+      std::lock_guard<std::mutex> lock(mutex);
+      size_t taken = 0;
+      while(taken < n && seeds && seeds->next(seedHost, seedUrls)) {
+        if(added.count(seedHost)) continue;
+
+        ++hosts;
+        ++taken;
+        f(static_cast<const std::vector<std::string> &>(seedUrls));
+      }
+
+      return taken;
+    }
+
+    // Workers tell whether they still have domains of their own, discovery is
+    // over once none has and nothing is queued.
+    void setBusy(bool &flag, bool busy) {
+      if(flag == busy) return;
+
+      std::lock_guard<std::mutex> lock(mutex);
+      busyWorkers += busy? 1: -1;
+      flag = busy;
+    }
+
+    bool isDone() {
+      std::lock_guard<std::mutex> lock(mutex);
+      return !busyWorkers && queue.empty() && !held && (!seeds || seeds->isExhausted());
+    }
+
+    // no work here, though more hosts may still come while held
+    bool isIdle() {
+      std::lock_guard<std::mutex> lock(mutex);
+      return !busyWorkers && queue.empty() && (!seeds || seeds->isExhausted());
+    }
+
+    // keeps discovery going while hosts may still arrive from elsewhere
+    void hold(bool h) {
+      std::lock_guard<std::mutex> lock(mutex);
+      held = h;
+    }
+
+    size_t size() {
+      std::lock_guard<std::mutex> lock(mutex);
+      return queue.size();
+    }
+
+    uint64_t getHosts() {
+      std::lock_guard<std::mutex> lock(mutex);
+      return hosts;
+    }
+
+    // snapshot of the queued urls, for checkpoints
+    std::vector<std::string> getQueue() {
+      std::lock_guard<std::mutex> lock(mutex);
+      return std::vector<std::string>(queue.begin(), queue.end());
+    }
+
+    // where the seed file continues, for checkpoints
+    uint64_t getSeedOffset() {
+      std::lock_guard<std::mutex> lock(mutex);
+      return seeds? seeds->getOffset(): 0;
+    }
+
+    // "<hosts>\n" and the known hosts, for checkpoints
+    void save(std::ostream &out) {
+      std::lock_guard<std::mutex> lock(mutex);
+      out << hosts << '\n';
+      seen->save(out);
+    }
+
+  private:
+    BlockedBloomSet *seen;
+    uint64_t maxHosts;
+    uint64_t hosts;
+    int busyWorkers;
+    bool held;
+    std::function<bool(const std::string &, const std::string &)> router;
+
+    SeedFile *seeds;
+    std::string seedHost;
+    std::vector<std::string> seedUrls;
+
+    // hosts of add(), exactly
+    std::unordered_set<std::string> added;
+
+    std::mutex mutex;
+    std::deque<std::string> queue;
+
+    // url is "http://host/path", as queued by discover()
+    bool isSeeded(const std::string &url) {
+      if(!seeds) return false;
+      seedHost.assign(url, 7, url.find('/', 7) - 7);
+      return seeds->contains(seedHost);
+    }
+
+    HostFrontier(const HostFrontier &);
+};
+
+#endif
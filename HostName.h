@@ -0,0 +1,26 @@
+#ifndef HOSTNAME_H
+#define HOSTNAME_H
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+
+// Brings "host[:port]" into the form hosts are known by: lower case, without
+// an explicit default port. False if the port is invalid.
+inline bool normalizeHost(std::string &host) {
+  for(auto &c: host) c = tolower(static_cast<unsigned char>(c));
+
+  size_t colon = host.find(':');
+  if(colon == std::string::npos) return true;
+
+  const char *p = host.c_str() + colon + 1;
+  if(!*p || strlen(p) > 5 || strspn(p, "0123456789") != strlen(p)) return false;
+
+  long port = atol(p);
+  if(port < 1 || port > 65535) return false;
+  if(port == 80) host.erase(colon);
+  return true;
+}
+
+#endif
@@ -0,0 +1,97 @@
+#ifndef HOSTPACE_H
+#define HOSTPACE_H
+
+#include <stdint.h>
+#include <algorithm>
+
+// Pause between request batches to one host, and the number of requests in
+// flight on its connection. A host gets a single connection, so its
+// concurrency is the pipeline depth, and the pause applies once per pipelined
+// batch, not per request. Both are fixed unless setBounds() is called: then
+// they adapt after every WINDOW responses (AIMD). More than one failure in ten
+// (errors, 429, 5xx) or responses taking over twice as long as in the best
+// window so far (plus some slack) halve the requests in flight and double the
+// pause; a clean window allows one more request in flight and shrinks the
+// pause by a quarter. A robots.txt Crawl-delay is a floor to the pause in any
+// case, and allows only one request at a time. Not thread-safe.
+class HostPace {
+  public:
+    static const uint64_t WINDOW = 4;
+    static const uint64_t MAX_CRAWL_DELAY_MILLISECONDS = 120000;
+
+    // the least pause after a backoff
+    static const uint64_t BACKOFF_MILLISECONDS = 100;
+
+    // latencies within this of the best are never slow, it is mostly noise
+    static const uint64_t LATENCY_SLACK_MICROSECONDS = 50000;
+
+    HostPace(): cooldown(0), minCooldown(0), maxCooldown(0), floor(0), depth(1), maxDepth(1), adaptive(false),
+      outcomes(0), failures(0), latencySum(0), bestLatency(0) { }
+
+    void setCooldown(uint64_t ms) {
+      cooldown = ms;
+      if(adaptive) cooldown = clamp(cooldown);
+    }
+
+    void setMaxDepth(uint64_t d) {
+      maxDepth = std::max<uint64_t>(1, d);
+      depth = std::min(depth, maxDepth);
+    }
+
+    // adapts the pause within [minMs, maxMs], starting with one request in flight
+    void setBounds(uint64_t minMs, uint64_t maxMs) {
+      minCooldown = minMs;
+      maxCooldown = std::max(minMs, maxMs);
+      adaptive = true;
+      cooldown = clamp(cooldown);
+      depth = 1;
+    }
+
+    // robots.txt Crawl-delay, capped at MAX_CRAWL_DELAY_MILLISECONDS
+    void setFloor(uint64_t ms) {
+      floor = ms;
+      if(floor > MAX_CRAWL_DELAY_MILLISECONDS) floor = MAX_CRAWL_DELAY_MILLISECONDS;
+      cooldown = std::max(cooldown, floor);
+    }
+
+    uint64_t getFloor() const { return floor; }
+    uint64_t getCooldown() const { return cooldown; }
+    uint64_t getDepth() const { return floor? 1: adaptive? depth: maxDepth; }
+
+    // one response (or failed request), latency in microseconds
+    void record(uint64_t latency, bool failed) {
+      if(!adaptive) return;
+
+      failures += failed;
+      latencySum += latency;
+      if(++outcomes < WINDOW) return;
+
+      uint64_t average = latencySum / outcomes;
+      bool slow = bestLatency && average > 2 * bestLatency + LATENCY_SLACK_MICROSECONDS;
+      if(!failures && (!bestLatency || average < bestLatency)) bestLatency = average;
+
+      if(failures * 10 > outcomes || slow) {
+        depth = std::max<uint64_t>(1, depth / 2);
+        uint64_t backoff = BACKOFF_MILLISECONDS;
+        cooldown = clamp(std::max(cooldown * 2, backoff));
+      } else if(!failures) {
+        depth = std::min(maxDepth, depth + 1);
+        cooldown = clamp(cooldown - (cooldown + 3) / 4);
+      }
+
+      outcomes = failures = latencySum = 0;
+    }
+
+  private:
+    uint64_t cooldown, minCooldown, maxCooldown, floor;
+    uint64_t depth, maxDepth;
+    bool adaptive;
+
+    uint64_t outcomes, failures, latencySum, bestLatency;
+
+    uint64_t clamp(uint64_t ms) const {
+      return std::max(floor, std::min(std::max(ms, minCooldown), maxCooldown));
+    }
+};
+
+#endif
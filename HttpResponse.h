@@ -0,0 +1,268 @@
+#ifndef HTTPRESPONSE_H
+#define HTTPRESPONSE_H
+
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <time.h>
+#include <string>
+
+// Incremental HTTP/1.x response framing. decode() works in place on a
+// receive buffer: header lines are handed out one by one and body bytes are
+// moved together (i.e. without chunk framing) behind the body decoded so far.
+class HttpResponse {
+  public:
+    enum Encoding { IDENTITY, GZIP, DEFLATE, UNSUPPORTED };
+
+    HttpResponse() {
+      reset();
+    }
+
+    void reset() {
+      resetHeaders();
+      remaining = 0;
+      consumed = 0;
+    }
+
+    // Decodes the raw bytes [raw, e). Header lines (status line and the empty
+    // line included) are passed to header(b, e) and body bytes are moved down
+    // to body. Stops at the end of the response. Returns the end of the
+    // decoded body, raw is advanced past everything processed.
+    template<class H> char *decode(char *body, char *&raw, char *e, const H &header) {
+      while(raw != e && state != COMPLETE) {
+        if(state == STATUS || state == HEADERS || state == CHUNK_SIZE || state == CHUNK_END || state == TRAILERS) {
+          char *nl = static_cast<char *>(memchr(raw, '\n', e - raw));
+          if(!nl) break;
+
+          if(state == STATUS && !isStatusLine(raw, nl)) {
+            // not HTTP at all, take everything as body
+            keepAlive = false;
+            state = UNTIL_CLOSE;
+            continue;
+          }
+
+          char *line = raw;
+          raw = nl + 1;
+          consumed += raw - line;
+
+          if(state == STATUS || state == HEADERS) header(line, raw);
+          handleLine(line, nl);
+        } else {
+          uint64_t n = e - raw;
+          if(state != UNTIL_CLOSE && remaining < n) n = remaining;
+
+          if(body != raw) memmove(body, raw, n);
+          body += n;
+          raw += n;
+          consumed += n;
+
+          if(state == UNTIL_CLOSE) continue;
+
+          remaining -= n;
+          if(!remaining) state = state == CHUNK_DATA? CHUNK_END: COMPLETE;
+        }
+      }
+
+      return body;
+    }
+
+    // the same, for a caller not interested in header lines
+    char *decode(char *body, char *&raw, char *e) {
+      return decode(body, raw, e, [](const char *, const char *) { });
+    }
+
+    // the server closed the connection
+    void handleEof() {
+      if(state == UNTIL_CLOSE) state = COMPLETE;
+      keepAlive = false;
+    }
+
+    bool isStarted() const { return consumed; }
+    bool isComplete() const { return state == COMPLETE; }
+    bool isKeepAlive() const { return keepAlive; }
+    int getStatus() const { return status; }
+
+    // the headers of the final (not interim) response are known
+    bool hasHeaders() const { return state != STATUS && state != HEADERS; }
+
+    // text, HTML or XML; also without Content-Type
+    bool isText() const { return text; }
+
+    // Content-Encoding of the body, decode() only removes the transfer framing
+    Encoding getEncoding() const { return encoding; }
+
+    // body length, -1 if it is chunked or ends with the connection
+    int64_t getContentLength() const { return chunked? -1: contentLength; }
+
+    // value of the Location header, empty without
+    const std::string &getLocation() const { return location; }
+
+    // value of the ETag header, empty without
+    const std::string &getEtag() const { return etag; }
+
+    // Last-Modified as seconds since the epoch, 0 if missing or not understood
+    time_t getLastModified() const { return lastModified; }
+
+    // raw bytes of this response received so far
+    uint64_t getConsumed() const { return consumed; }
+
+    static const size_t DATE_LENGTH = 29;
+
+    // Sun, 06 Nov 1994 08:49:37 GMT, 0 if it is in another format
+    static time_t parseDate(const char *b, const char *e) {
+      char date[64];
+      if(e - b >= static_cast<ptrdiff_t>(sizeof(date))) return 0;
+      memcpy(date, b, e - b);
+      date[e - b] = 0;
+
+      struct tm tm;
+      memset(&tm, 0, sizeof(tm));
+
+      const char *end = strptime(date, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+      if(!end || *end) return 0;
+      return timegm(&tm);
+    }
+
+    // writes DATE_LENGTH characters and a terminating zero to out
+    static void formatDate(time_t t, char *out) {
+      struct tm tm;
+      gmtime_r(&t, &tm);
+      strftime(out, DATE_LENGTH + 1, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    }
+
+  private:
+    enum State {
+      STATUS, HEADERS, LENGTH, CHUNK_SIZE, CHUNK_DATA, CHUNK_END, TRAILERS, UNTIL_CLOSE, COMPLETE
+    };
+
+    State state;
+    int status;
+    bool keepAlive;
+    bool chunked;
+    bool text;
+    Encoding encoding;
+    std::string location;
+    std::string etag;
+    time_t lastModified;
+    int64_t contentLength;
+    uint64_t remaining;
+    uint64_t consumed;
+
+    static bool isHeader(const char *b, const char *e, const char *name) {
+      size_t n = strlen(name);
+      return static_cast<size_t>(e - b) > n && !strncasecmp(b, name, n) && b[n] == ':';
+    }
+
+    static const char *headerValue(const char *b, const char *e) {
+      while(b != e && *b != ':') ++b;
+      if(b != e) ++b;
+      while(b != e && (*b == ' ' || *b == '\t')) ++b;
+      return b;
+    }
+
+    static bool containsToken(const char *b, const char *e, const char *token) {
+      size_t n = strlen(token);
+      for(; static_cast<size_t>(e - b) >= n; ++b) if(!strncasecmp(b, token, n)) return true;
+      return false;
+    }
+
+    // HTTP/1.1 200 OK, e points to the '\n'
+    static bool isStatusLine(const char *b, const char *e) {
+      if(e != b && e[-1] == '\r') --e;
+      return e - b >= 12 && !strncmp(b, "HTTP/1.", 7);
+    }
+
+    void resetHeaders() {
+      state = STATUS;
+      status = 0;
+      keepAlive = true;
+      chunked = false;
+      text = true;
+      encoding = IDENTITY;
+      location.clear();
+      etag.clear();
+      lastModified = 0;
+      contentLength = -1;
+    }
+
+    // e points to the '\n'
+    void handleLine(const char *b, const char *e) {
+      if(e != b && e[-1] == '\r') --e;
+
+      switch(state) {
+        case STATUS:
+          keepAlive = b[7] != '0';
+          status = atoi(b + 9);
+          state = HEADERS;
+          break;
+
+        case HEADERS:
+          if(b == e) {
+            startBody();
+          } else if(isHeader(b, e, "Content-Length")) {
+            contentLength = strtoll(headerValue(b, e), 0, 10);
+          } else if(isHeader(b, e, "Transfer-Encoding")) {
+            chunked = containsToken(headerValue(b, e), e, "chunked");
+          } else if(isHeader(b, e, "Content-Type")) {
+            const char *value = headerValue(b, e);
+            text = (e - value >= 5 && !strncasecmp(value, "text/", 5)) ||
+              containsToken(value, e, "html") || containsToken(value, e, "xml");
+          } else if(isHeader(b, e, "Content-Encoding")) {
+            const char *value = headerValue(b, e);
+            if(containsToken(value, e, "gzip")) {
+              encoding = GZIP;
+            } else if(containsToken(value, e, "deflate")) {
+              encoding = DEFLATE;
+            } else if(value != e && !containsToken(value, e, "identity")) {
+              encoding = UNSUPPORTED;
+            }
+          } else if(isHeader(b, e, "Location")) {
+            location.assign(headerValue(b, e), e);
+          } else if(isHeader(b, e, "ETag")) {
+            etag.assign(headerValue(b, e), e);
+          } else if(isHeader(b, e, "Last-Modified")) {
+            lastModified = parseDate(headerValue(b, e), e);
+          } else if(isHeader(b, e, "Connection")) {
+            if(containsToken(headerValue(b, e), e, "close")) keepAlive = false;
+            if(containsToken(headerValue(b, e), e, "keep-alive")) keepAlive = true;
+          }
+          break;
+
+        case CHUNK_SIZE:
+          remaining = strtoull(b, 0, 16);
+          state = remaining? CHUNK_DATA: TRAILERS;
+          break;
+
+        case CHUNK_END:
+          state = CHUNK_SIZE;
+          break;
+
+        case TRAILERS:
+          if(b == e) state = COMPLETE;
+          break;
+
+        default:
+          break;
+      }
+    }
+
+    void startBody() {
+      if(status >= 100 && status < 200) {
+        // interim response, the real one follows with headers of its own
+        resetHeaders();
+      } else if(status == 204 || status == 304) {
+        state = COMPLETE;
+      } else if(chunked) {
+        state = CHUNK_SIZE;
+      } else if(contentLength >= 0) {
+        remaining = contentLength;
+        state = remaining? LENGTH: COMPLETE;
+      } else {
+        keepAlive = false;
+        state = UNTIL_CLOSE;
+      }
+    }
+};
+
+#endif
@@ -0,0 +1,91 @@
+#ifndef INFLATER_H
+#define INFLATER_H
+
+#include <stdint.h>
+#include <string.h>
+#include <zlib.h>
+
+// Streaming decompression of gzip and deflate response bodies. The zlib state
+// is set up by the first response using it and only reset for the following
+// ones, until release().
+class Inflater {
+  public:
+    Inflater(): initialized(false) { }
+
+    ~Inflater() {
+      release();
+    }
+
+    // starts a new body; "deflate" is meant to be zlib format, but raw deflate
+    // data is accepted as well
+    void reset() {
+      if(!initialized) {
+        memset(&stream, 0, sizeof(stream));
+        initialized = inflateInit2(&stream, AUTO_WINDOW_BITS) == Z_OK;
+      } else {
+        inflateReset2(&stream, AUTO_WINDOW_BITS);
+      }
+
+      raw = false;
+      started = ended = false;
+    }
+
+    // frees the zlib state
+    void release() {
+      if(initialized) inflateEnd(&stream);
+      initialized = false;
+    }
+
+    // Decompresses from [in, inEnd) to [out, outEnd), advancing in and out.
+    // Returns false on corrupt data. Anything after the end of the compressed
+    // data is skipped.
+    bool inflate(const char *&in, const char *inEnd, char *&out, char *outEnd) {
+      if(!initialized) return false;
+      if(ended) {
+        in = inEnd;
+        return true;
+      }
+
+      stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(in));
+      stream.avail_in = inEnd - in;
+      stream.next_out = reinterpret_cast<Bytef *>(out);
+      stream.avail_out = outEnd - out;
+
+      int result = ::inflate(&stream, Z_NO_FLUSH);
+
+      // no zlib header after all: raw deflate, retried from the start
+      if(result == Z_DATA_ERROR && !started && !raw) {
+        raw = true;
+        inflateReset2(&stream, RAW_WINDOW_BITS);
+        return inflate(in, inEnd, out, outEnd);
+      }
+
+      if(result != Z_OK && result != Z_STREAM_END && result != Z_BUF_ERROR) return false;
+
+      // past the zlib header, which tells the formats apart
+      started = stream.total_in >= 2 || stream.total_out;
+      in = reinterpret_cast<const char *>(stream.next_in);
+      out = reinterpret_cast<char *>(stream.next_out);
+
+      if(result == Z_STREAM_END) {
+        ended = true;
+        in = inEnd;
+      }
+
+      return true;
+    }
+
+  private:
+    // 15 bit window, zlib or gzip header detected
+    static const int AUTO_WINDOW_BITS = 15 + 32;
+    static const int RAW_WINDOW_BITS = -15;
+
+    z_stream stream;
+    bool initialized;
+    bool raw;
+    bool started, ended;
+
+    Inflater(const Inflater &);
+};
+
+#endif
@@ -0,0 +1,54 @@
+#ifndef IOBACKEND_H
+#define IOBACKEND_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+#include "SocketAddress.h"
+
+enum IoOperation {
+  IO_CONNECT, IO_RECEIVE, IO_SEND
+};
+
+struct IoCompletion {
+  uint64_t slot;
+  uint64_t connection;
+  IoOperation operation;
+  int64_t result; // bytes transferred or -errno
+};
+
+// Completion based socket I/O. A connection has at most one receive and one
+// send outstanding, the buffers have to stay valid until they completed or
+// the connection is closed. Connection ids are never reused, so completions
+// of closed connections can be told apart.
+class IoBackend {
+  public:
+    virtual ~IoBackend() { }
+
+    // starts a non-blocking TCP connection, completions report the slot given here
+    virtual uint64_t connect(uint64_t slot, const SocketAddress &addr) = 0;
+    virtual void receive(uint64_t connection, char *b, size_t n) = 0;
+    virtual void send(uint64_t connection, const char *b, size_t n) = 0;
+
+    // no buffer of the connection is touched afterwards
+    virtual void close(uint64_t connection) = 0;
+
+    // waits up to timeout milliseconds for completions and appends them
+    virtual void wait(int timeout, std::vector<IoCompletion> &completions) = 0;
+
+  protected:
+    static const uint64_t SEQUENCE_LIMIT = (1ull << 30) - 1;
+
+    static int connectionFd(uint64_t connection) {
+      return static_cast<int32_t>(connection);
+    }
+
+    // The sequence (from 1) wraps within 30 bits, never giving 0, so a backend
+    // can shift in two bits of its own, as UringBackend does with the operation.
+    static uint64_t makeConnection(uint64_t sequence, int fd) {
+      sequence = (sequence - 1) % SEQUENCE_LIMIT + 1;
+      return sequence << 32 | static_cast<uint32_t>(fd);
+    }
+};
+
+#endif
@@ -0,0 +1,55 @@
+#ifndef IPCOOLDOWN_H
+#define IPCOOLDOWN_H
+
+#include <stdint.h>
+#include <unordered_map>
+#include <mutex>
+
+// Earliest time of the next fetch from each server address, so virtual
+// hosts on one server share its cooldown. The cooldown counts from the start
+// of each fetch. Thread-safe, shared by all workers.
+class IpCooldown {
+  public:
+    IpCooldown(): pruneAt(PRUNE_MINIMUM) { }
+
+    // Returns now and reserves the server (see SocketAddress::getServer())
+    // until now + cooldown if it is free, otherwise the time it becomes free.
+    uint64_t reserve(uint64_t server, uint64_t now, uint64_t cooldown) {
+      std::lock_guard<std::mutex> lock(mutex);
+      if(nextFetch.size() >= pruneAt) prune(now);
+
+      uint64_t &next = nextFetch[server];
+      if(next > now) return next;
+
+      next = now + cooldown;
+      return now;
+    }
+
+    size_t size() {
+      std::lock_guard<std::mutex> lock(mutex);
+      return nextFetch.size();
+    }
+
+  private:
+    static const size_t PRUNE_MINIMUM = 1024;
+
+    std::mutex mutex;
+    std::unordered_map<uint64_t, uint64_t> nextFetch;
+    size_t pruneAt;
+
+    // forgets free addresses, whenever the table doubled since the last time
+    void prune(uint64_t now) {
+      for(auto i = nextFetch.begin(); i != nextFetch.end();) {
+        if(i->second <= now) {
+          i = nextFetch.erase(i);
+        } else {
+          ++i;
+        }
+      }
+
+      pruneAt = 2 * nextFetch.size();
+      if(pruneAt < PRUNE_MINIMUM) pruneAt = PRUNE_MINIMUM;
+    }
+};
+
+#endif
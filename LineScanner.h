@@ -0,0 +1,109 @@
+#ifndef LINESCANNER_H
+#define LINESCANNER_H
+
+#include "Hash.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <emmintrin.h>
+#include <immintrin.h>
+
+// Splits a buffer into lines and computes hashBytes() of each line in the
+// same pass: the buffer is searched for newlines 64 bytes at a time (AVX2 or
+// SSE2, chosen at runtime) and hashing follows directly behind over the
+// bytes just loaded. Incomplete lines are remembered relative to their
+// start, so the caller may move the rest of the buffer before the next call.
+class LineScanner {
+  public:
+    LineScanner(): newlines(__builtin_cpu_supports("avx2")? newlinesAvx2: newlinesSse2) {
+      reset();
+    }
+
+    void reset() {
+      hash = HASH_SEED;
+      hashed = 0;
+      scanned = 0;
+    }
+
+    // calls f(b, e, hash) for every complete line [b, e) (including the '\n'),
+    // returns the start of the incomplete rest
+    template<class F> const char *scan(const char *b, const char *e, const F &f) {
+      const char *s = b + scanned;
+
+      while(e - s >= 64) {
+        uint64_t mask = newlines(s);
+
+        while(mask) {
+          b = emit(b, s + __builtin_ctzll(mask), f);
+          mask &= mask - 1;
+        }
+
+        s += 64;
+        hashUpTo(b, s);
+      }
+
+      for(; s != e; ++s) {
+        if(*s == '\n') b = emit(b, s, f);
+      }
+
+      hashUpTo(b, e);
+      scanned = e - b;
+      return b;
+    }
+
+  private:
+    uint64_t (*newlines)(const char *);
+
+    uint64_t hash;
+    size_t hashed;
+    size_t scanned;
+
+    static uint64_t newlinesSse2(const char *s) {
+      const __m128i nl = _mm_set1_epi8('\n');
+      uint64_t mask = 0;
+
+      for(int i = 0; i < 4; ++i) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(s) + i);
+        mask |= static_cast<uint64_t>(static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(v, nl)))) << (16 * i);
+      }
+
+      return mask;
+    }
+
+    __attribute__((target("avx2"))) static uint64_t newlinesAvx2(const char *s) {
+      const __m256i nl = _mm256_set1_epi8('\n');
+
+      __m256i lo = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(s));
+      __m256i hi = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(s) + 1);
+
+      return static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, nl))) |
+        static_cast<uint64_t>(static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, nl)))) << 32;
+    }
+
+    // fold all complete words of the current line (starting at b) up to e
+    void hashUpTo(const char *b, const char *e) {
+      for(; e - (b + hashed) >= 8; hashed += 8) {
+        uint64_t w;
+        memcpy(&w, b + hashed, 8);
+        hash = hashWord(hash, w);
+      }
+    }
+
+    template<class F> const char *emit(const char *b, const char *nl, const F &f) {
+      const char *end = nl + 1;
+      hashUpTo(b, end);
+
+      uint64_t h = hash;
+      if(b + hashed != end) {
+        uint64_t w = 0;
+        memcpy(&w, b + hashed, end - (b + hashed));
+        h = hashWord(h, w);
+      }
+
+      f(b, end, hashFinish(h, end - b));
+      reset();
+      return end;
+    }
+};
+
+#endif
@@ -0,0 +1,319 @@
+#ifndef LINKSCANNER_H
+#define LINKSCANNER_H
+
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <algorithm>
+
+// Incremental HTML tokenizer which finds the href and src attributes of all
+// tags, fed with the body in chunks of any size. Values inside one chunk are
+// reported in place; only values split between chunks or containing entities
+// are assembled in a buffer. Comments and the contents of script and style
+// elements are skipped.
+class LinkScanner {
+  public:
+    enum Kind { LINK, BASE };
+
+    static const size_t MAX_VALUE = 4096;
+
+    LinkScanner() {
+      reset();
+    }
+
+    void reset() {
+      state = TEXT;
+      name.clear();
+      tag.clear();
+      value.clear();
+      relevant = buffered = false;
+    }
+
+    // calls f(b, e, kind) for every attribute value [b, e) found, where
+    // kind is BASE for <base href>
+    template<class F> void scan(const char *b, const char *e, const F &f) {
+      const char *valueBegin = b;
+
+      for(const char *s = b; s != e; ++s) {
+        char c = *s;
+
+        switch(state) {
+          case TEXT: {
+            s = static_cast<const char *>(memchr(s, '<', e - s));
+            if(!s) return;
+
+            state = TAG_OPEN;
+            break;
+          }
+
+          case TAG_OPEN:
+            if(c == '!') {
+              state = DECLARATION;
+              matched = 0;
+            } else if(c == '/') {
+              state = TAG_SKIP;
+            } else if(isLetter(c)) {
+              tag.assign(1, lower(c));
+              state = TAG_NAME;
+            } else {
+              state = TEXT;
+              --s;
+            }
+            break;
+
+          case DECLARATION:
+            // "<!--" starts a comment, anything else ends at '>'
+            if(c == '-' && matched < 2) {
+              if(++matched == 2) {
+                state = COMMENT;
+                matched = 0;
+              }
+            } else if(c == '>') {
+              state = TEXT;
+            } else {
+              state = TAG_SKIP;
+            }
+            break;
+
+          case COMMENT:
+            if(c == '-') {
+              ++matched;
+            } else {
+              if(c == '>' && matched >= 2) state = TEXT;
+              matched = 0;
+            }
+            break;
+
+          case TAG_SKIP:
+            if(c == '>') state = TEXT;
+            break;
+
+          case TAG_NAME:
+            if(isSpace(c) || c == '/') {
+              state = BEFORE_ATTRIBUTE;
+            } else if(c == '>') {
+              endTag();
+            } else if(tag.length() < MAX_NAME) {
+              tag.push_back(lower(c));
+            }
+            break;
+
+          case BEFORE_ATTRIBUTE:
+            if(c == '>') {
+              endTag();
+            } else if(!isSpace(c) && c != '/') {
+              name.assign(1, lower(c));
+              state = ATTRIBUTE_NAME;
+            }
+            break;
+
+          case ATTRIBUTE_NAME:
+            if(c == '=') {
+              state = BEFORE_VALUE;
+            } else if(isSpace(c)) {
+              state = AFTER_ATTRIBUTE_NAME;
+            } else if(c == '>') {
+              endTag();
+            } else if(c == '/') {
+              state = BEFORE_ATTRIBUTE;
+            } else if(name.length() < MAX_NAME) {
+              name.push_back(lower(c));
+            }
+            break;
+
+          case AFTER_ATTRIBUTE_NAME:
+            if(c == '=') {
+              state = BEFORE_VALUE;
+            } else if(c == '>') {
+              endTag();
+            } else if(!isSpace(c)) {
+              name.assign(1, lower(c));
+              state = ATTRIBUTE_NAME;
+            }
+            break;
+
+          case BEFORE_VALUE:
+            if(isSpace(c)) break;
+            if(c == '>') {
+              endTag();
+              break;
+            }
+
+            relevant = name == "href" || name == "src";
+            buffered = false;
+            value.clear();
+
+            if(c == '"' || c == '\'') {
+              quote = c;
+              valueBegin = s + 1;
+            } else {
+              quote = 0;
+              valueBegin = s;
+            }
+            state = VALUE;
+            break;
+
+          case VALUE:
+            if(quote? c == quote: isSpace(c) || c == '>') {
+              if(relevant) emit(valueBegin, s, f);
+
+              if(c == '>') {
+                endTag();
+              } else {
+                state = BEFORE_ATTRIBUTE;
+              }
+            }
+            break;
+
+          case RAW_TEXT:
+            // inside script or style, up to "</script" or "</style"
+            if(matched < 2) {
+              matched = c == "</"[matched]? matched + 1: c == '<';
+            } else if(matched - 2 < tag.length() && lower(c) == tag[matched - 2]) {
+              if(++matched - 2 == tag.length()) state = TAG_SKIP;
+            } else {
+              matched = c == '<';
+            }
+            break;
+        }
+      }
+
+      // the value continues in the next chunk
+      if(state == VALUE && relevant) {
+        if(!buffered) {
+          value.clear();
+          buffered = true;
+        }
+
+        if(value.length() + (e - valueBegin) > MAX_VALUE) {
+          relevant = false;
+        } else {
+          value.append(valueBegin, e);
+        }
+      }
+    }
+
+  private:
+    static const size_t MAX_NAME = 16;
+
+    enum State { TEXT, TAG_OPEN, DECLARATION, COMMENT, TAG_SKIP, TAG_NAME, BEFORE_ATTRIBUTE, ATTRIBUTE_NAME,
+      AFTER_ATTRIBUTE_NAME, BEFORE_VALUE, VALUE, RAW_TEXT };
+
+    State state;
+    std::string tag, name;
+    bool relevant;
+    char quote;
+    size_t matched;
+
+    // value assembled across chunks, or with entities decoded
+    std::string value;
+    bool buffered;
+    std::string decoded;
+
+    static bool isSpace(char c) {
+      return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f';
+    }
+
+    static bool isLetter(char c) {
+      return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+    }
+
+    static char lower(char c) {
+      return (c >= 'A' && c <= 'Z')? c + ('a' - 'A'): c;
+    }
+
+    void endTag() {
+      if(tag == "script" || tag == "style") {
+        state = RAW_TEXT;
+        matched = 0;
+      } else {
+        state = TEXT;
+      }
+    }
+
+    template<class F> void emit(const char *b, const char *e, const F &f) {
+      if(buffered) {
+        if(value.length() + (e - b) > MAX_VALUE) return;
+
+        value.append(b, e);
+        b = value.data();
+        e = b + value.length();
+        buffered = false;
+      }
+
+      if(memchr(b, '&', e - b)) {
+        decode(b, e);
+        b = decoded.data();
+        e = b + decoded.length();
+      }
+
+      f(b, e, tag == "base"? BASE: LINK);
+    }
+
+    // replaces character references, the ones not understood stay as they are
+    void decode(const char *b, const char *e) {
+      decoded.clear();
+
+      while(b != e) {
+        const char *amp = static_cast<const char *>(memchr(b, '&', e - b));
+        if(!amp) amp = e;
+        decoded.append(b, amp);
+        if(amp == e) break;
+
+        const char *semicolon = static_cast<const char *>(memchr(amp, ';', std::min<size_t>(e - amp, 10)));
+        uint32_t code = semicolon? reference(amp + 1, semicolon): 0;
+
+        if(code) {
+          appendUtf8(code);
+          b = semicolon + 1;
+        } else {
+          decoded.push_back('&');
+          b = amp + 1;
+        }
+      }
+    }
+
+    static uint32_t reference(const char *b, const char *e) {
+      std::string r(b, e);
+
+      if(r == "amp") return '&';
+      if(r == "quot") return '"';
+      if(r == "apos") return '\'';
+      if(r == "lt") return '<';
+      if(r == "gt") return '>';
+      if(r.length() < 2 || r[0] != '#') return 0;
+
+      uint32_t code = 0;
+      bool hex = r[1] == 'x' || r[1] == 'X';
+      for(size_t i = hex? 2: 1; i < r.length(); ++i) {
+        char c = lower(r[i]);
+        uint32_t digit = c >= '0' && c <= '9'? c - '0': hex && c >= 'a' && c <= 'f'? c - 'a' + 10: 100;
+        if(digit >= (hex? 16u: 10u)) return 0;
+
+        code = code * (hex? 16: 10) + digit;
+        if(code > 0x10ffff) return 0;
+      }
+
+      return code;
+    }
+
+    void appendUtf8(uint32_t code) {
+      if(code < 0x80) {
+        decoded.push_back(code);
+      } else if(code < 0x800) {
+        decoded.push_back(0xc0 | code >> 6);
+        decoded.push_back(0x80 | (code & 0x3f));
+      } else if(code < 0x10000) {
+        decoded.push_back(0xe0 | code >> 12);
+        decoded.push_back(0x80 | (code >> 6 & 0x3f));
+        decoded.push_back(0x80 | (code & 0x3f));
+      } else {
+        decoded.push_back(0xf0 | code >> 18);
+        decoded.push_back(0x80 | (code >> 12 & 0x3f));
+        decoded.push_back(0x80 | (code >> 6 & 0x3f));
+        decoded.push_back(0x80 | (code & 0x3f));
+      }
+    }
+};
+
+#endif
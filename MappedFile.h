@@ -0,0 +1,74 @@
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <string>
+#include <stdexcept>
+
+// Zero-initialized memory, either anonymous or backed by a (sparse) file.
+// Pages are only materialized when touched, so no bzero is necessary.
+class MappedFile {
+  public:
+    MappedFile(uint64_t size): size(size), fresh(true) {
+      data = static_cast<unsigned char *>(mmap(0, size, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0));
+      if(data == MAP_FAILED) throw std::runtime_error("could not map memory: " + std::string(strerror(errno)));
+    }
+
+    MappedFile(const std::string &filename, uint64_t size): size(size) {
+      int fd = open(filename.c_str(), O_CREAT | O_LARGEFILE | O_RDWR, 0644);
+      if(fd < 0) throw std::runtime_error("could not open " + filename + ": " + strerror(errno));
+
+      struct stat st;
+      if(fstat(fd, &st) < 0) {
+        close(fd);
+        throw std::runtime_error("could not stat " + filename + ": " + strerror(errno));
+      }
+
+      fresh = st.st_size == 0;
+      if(!fresh && static_cast<uint64_t>(st.st_size) != size) {
+        close(fd);
+        throw std::runtime_error("size mismatch in " + filename);
+      }
+
+      if(fresh && ftruncate(fd, size) < 0) {
+        close(fd);
+        throw std::runtime_error("could not resize " + filename + ": " + strerror(errno));
+      }
+
+      data = static_cast<unsigned char *>(mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0));
+      close(fd);
+      if(data == MAP_FAILED) throw std::runtime_error("could not map " + filename + ": " + strerror(errno));
+    }
+
+    ~MappedFile() {
+      munmap(data, size);
+    }
+
+    unsigned char *getData() const { return data; }
+    uint64_t getSize() const { return size; }
+
+    // true if the memory did not exist before (i.e. is all zero)
+    bool isFresh() const { return fresh; }
+
+    // MS_ASYNC only schedules writeback, the kernel does it in the background
+    void sync(bool wait) {
+      msync(data, size, wait? MS_SYNC: MS_ASYNC);
+    }
+
+  private:
+    uint64_t size;
+    bool fresh;
+    unsigned char *data;
+
+    MappedFile(const MappedFile &);
+};
+
+#endif
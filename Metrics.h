@@ -0,0 +1,200 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <ostream>
+#include <stdexcept>
+
+// Monotonically increasing count. Thread-safe.
+class Counter {
+  public:
+    Counter(): value(0) { }
+
+    void add(uint64_t n = 1) {
+      value.fetch_add(n, std::memory_order_relaxed);
+    }
+
+    uint64_t get() const {
+      return value.load(std::memory_order_relaxed);
+    }
+
+  private:
+    std::atomic<uint64_t> value;
+};
+
+// Value which goes up and down. Thread-safe.
+class Gauge {
+  public:
+    Gauge(): value(0) { }
+
+    void set(double v) {
+      value.store(v, std::memory_order_relaxed);
+    }
+
+    double get() const {
+      return value.load(std::memory_order_relaxed);
+    }
+
+  private:
+    std::atomic<double> value;
+};
+
+// Distribution of durations in microseconds. Like an HDR histogram, every
+// power of two is split into 8 linear buckets, so any value is known within
+// 12.5% and recording is a single increment. Thread-safe.
+class Histogram {
+  public:
+    Histogram(): counts(BUCKETS), sum(0) { }
+
+    void record(uint64_t value) {
+      counts[bucket(value)].fetch_add(1, std::memory_order_relaxed);
+      sum.fetch_add(value, std::memory_order_relaxed);
+    }
+
+    uint64_t getCount() const {
+      uint64_t n = 0;
+      for(auto &c: counts) n += c.load(std::memory_order_relaxed);
+      return n;
+    }
+
+    uint64_t getSum() const {
+      return sum.load(std::memory_order_relaxed);
+    }
+
+    // number of values below limit, which has to be a power of two
+    uint64_t countBelow(uint64_t limit) const {
+      uint64_t n = 0;
+      for(uint32_t i = 0; i < bucket(limit); ++i) n += counts[i].load(std::memory_order_relaxed);
+      return n;
+    }
+
+    // upper end of the bucket holding the q-quantile, 0 without values
+    uint64_t quantile(double q) const {
+      uint64_t total = getCount();
+      if(!total) return 0;
+
+      uint64_t rank = static_cast<uint64_t>(q * (total - 1));
+      uint64_t n = 0;
+      for(uint32_t i = 0; i < BUCKETS - 1; ++i) {
+        n += counts[i].load(std::memory_order_relaxed);
+        if(n > rank) return lowest(i + 1);
+      }
+
+      return UINT64_MAX;
+    }
+
+  private:
+    static const uint32_t SUB_BITS = 3;
+    static const uint32_t SUB_BUCKETS = 1 << SUB_BITS;
+    static const uint32_t BUCKETS = (64 - SUB_BITS + 1) * SUB_BUCKETS;
+
+    std::vector<std::atomic<uint64_t>> counts;
+    std::atomic<uint64_t> sum;
+
+    static uint32_t bucket(uint64_t value) {
+      if(value < SUB_BUCKETS) return value;
+
+      uint32_t shift = 63 - __builtin_clzll(value) - SUB_BITS;
+      return (shift + 1) * SUB_BUCKETS + (value >> shift) - SUB_BUCKETS;
+    }
+
+    // smallest value of bucket i
+    static uint64_t lowest(uint32_t i) {
+      if(i < SUB_BUCKETS) return i;
+
+      uint32_t shift = i / SUB_BUCKETS - 1;
+      return static_cast<uint64_t>(SUB_BUCKETS + i % SUB_BUCKETS) << shift;
+    }
+};
+
+// Named metrics, written in the Prometheus text format. Asking for a name
+// again returns the same metric, so every component registers what it
+// updates. Histograms are exported in seconds.
+class Metrics {
+  public:
+    Metrics() { }
+
+    ~Metrics() {
+      for(auto &m: metrics) {
+        delete m.counter;
+        delete m.gauge;
+        delete m.histogram;
+      }
+    }
+
+    Counter &counter(const std::string &name, const std::string &help) {
+      return *find(name, help, "counter").counter;
+    }
+
+    Gauge &gauge(const std::string &name, const std::string &help) {
+      return *find(name, help, "gauge").gauge;
+    }
+
+    Histogram &histogram(const std::string &name, const std::string &help) {
+      return *find(name, help, "histogram").histogram;
+    }
+
+    void write(std::ostream &out) {
+      std::lock_guard<std::mutex> lock(mutex);
+
+      for(auto &m: metrics) {
+        out << "# HELP " << m.name << ' ' << m.help << '\n';
+        out << "# TYPE " << m.name << ' ' << m.type << '\n';
+
+        if(m.counter) out << m.name << ' ' << m.counter->get() << '\n';
+        if(m.gauge) out << m.name << ' ' << m.gauge->get() << '\n';
+        if(m.histogram) {
+          for(uint32_t shift = MIN_BOUND_SHIFT; shift <= MAX_BOUND_SHIFT; ++shift) {
+            out << m.name << "_bucket{le=\"" << (1ull << shift) / 1e6 << "\"} " << m.histogram->countBelow(1ull << shift) << '\n';
+          }
+
+          uint64_t count = m.histogram->getCount();
+          out << m.name << "_bucket{le=\"+Inf\"} " << count << '\n';
+          out << m.name << "_sum " << m.histogram->getSum() / 1e6 << '\n';
+          out << m.name << "_count " << count << '\n';
+        }
+      }
+    }
+
+  private:
+    // exported bucket bounds: 16 microseconds to 67 seconds
+    static const uint32_t MIN_BOUND_SHIFT = 4;
+    static const uint32_t MAX_BOUND_SHIFT = 26;
+
+    struct Metric {
+      std::string name, help, type;
+      Counter *counter;
+      Gauge *gauge;
+      Histogram *histogram;
+    };
+
+    std::mutex mutex;
+    std::vector<Metric> metrics;
+
+    // the metric called name, created if it is new
+    Metric find(const std::string &name, const std::string &help, const std::string &type) {
+      std::lock_guard<std::mutex> lock(mutex);
+
+      for(auto &m: metrics) {
+        if(m.name != name) continue;
+        if(m.type != type) throw std::runtime_error("metric registered with different type: " + name);
+        return m;
+      }
+
+      Metric m { name, help, type, 0, 0, 0 };
+      if(type == "counter") m.counter = new Counter();
+      if(type == "gauge") m.gauge = new Gauge();
+      if(type == "histogram") m.histogram = new Histogram();
+
+      metrics.push_back(m);
+      return m;
+    }
+
+    Metrics(const Metrics &);
+};
+
+#endif
@@ -0,0 +1,190 @@
+#ifndef OUTPUTLOG_H
+#define OUTPUTLOG_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <sstream>
+#include <fstream>
+#include <stdexcept>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <errno.h>
+#include <zlib.h>
+
+// Append-only crawl output. Records (host, path, data) are collected into
+// blocks, which are deflated and appended to segment files
+// "<prefix>.<n>.log" of roughly fixed size. Each segment has a text index
+// "<prefix>.<n>.idx" with one line per record:
+//   <block offset> <offset in block> <data length> http://<host><path>
+// Existing segments are never modified, a resumed crawl starts a new one.
+class OutputLog {
+  public:
+    // decompressed blocks: RecordHeader, host, path, data, RecordHeader, ...
+    struct BlockHeader {
+      char magic[4];
+      uint32_t compressedSize;
+      uint32_t size;
+      uint32_t records;
+    };
+
+    struct RecordHeader {
+      uint32_t hostLength;
+      uint32_t pathLength;
+      uint32_t dataLength;
+    };
+
+    OutputLog(const std::string &prefix, uint64_t segmentSize = 1024ull * 1024 * 1024):
+        prefix(prefix), segmentSize(segmentSize), segment(-1), logFd(-1), indexFd(-1), segmentFill(0), written(0) {
+      block.reserve(BLOCK_SIZE);
+    }
+
+    ~OutputLog() {
+      flush();
+      closeSegment();
+    }
+
+    void append(const std::string &host, const std::string &path, const char *b, const char *e) {
+      if(!block.empty() && block.size() + sizeof(RecordHeader) + host.length() + path.length() + (e - b) > BLOCK_SIZE) flush();
+
+      RecordHeader header { static_cast<uint32_t>(host.length()), static_cast<uint32_t>(path.length()), static_cast<uint32_t>(e - b) };
+      index.push_back(IndexEntry { block.size(), header.dataLength, host + path });
+
+      block.append(reinterpret_cast<const char *>(&header), sizeof(header));
+      block.append(host);
+      block.append(path);
+      block.append(b, e);
+    }
+
+    // compresses and writes the current block
+    void flush() {
+      if(block.empty()) return;
+
+      uLongf compressedSize = compressBound(block.size());
+      compressed.resize(sizeof(BlockHeader) + compressedSize);
+      if(compress2(reinterpret_cast<Bytef *>(&compressed[sizeof(BlockHeader)]), &compressedSize,
+            reinterpret_cast<const Bytef *>(block.data()), block.size(), COMPRESSION_LEVEL) != Z_OK) {
+        throw std::runtime_error("compression failed for " + prefix);
+      }
+
+      BlockHeader header { { 'P', 'n', 'R', 'a' },
+        static_cast<uint32_t>(compressedSize), static_cast<uint32_t>(block.size()), static_cast<uint32_t>(index.size()) };
+      memcpy(&compressed[0], &header, sizeof(header));
+      compressed.resize(sizeof(BlockHeader) + compressedSize);
+
+      if(logFd < 0 || (segmentFill && segmentFill + compressed.size() > segmentSize)) openSegment();
+
+      std::ostringstream lines;
+      for(auto &entry: index) lines << segmentFill << ' ' << entry.offset << ' ' << entry.length << " http://" << entry.url << '\n';
+
+      std::string text = lines.str();
+      writeAll(logFd, compressed.data(), compressed.size());
+      writeAll(indexFd, text.data(), text.size());
+
+      segmentFill += compressed.size();
+      written += compressed.size();
+
+      block.clear();
+      index.clear();
+    }
+
+    // compressed bytes written so far
+    uint64_t getWritten() const {
+      return written;
+    }
+
+    // calls f(host, path, data) for every record of a segment
+    template<class F> static void read(const std::string &filename, const F &f) {
+      std::ifstream in(filename.c_str(), std::ios::binary);
+      std::string compressed, block;
+
+      BlockHeader header;
+      while(in.read(reinterpret_cast<char *>(&header), sizeof(header))) {
+        if(memcmp(header.magic, "PnRa", 4)) throw std::runtime_error("corrupt segment " + filename);
+
+        compressed.resize(header.compressedSize);
+        block.resize(header.size);
+        uLongf size = header.size;
+
+        if(!in.read(&compressed[0], compressed.size()) ||
+            uncompress(reinterpret_cast<Bytef *>(&block[0]), &size, reinterpret_cast<const Bytef *>(compressed.data()), compressed.size()) != Z_OK ||
+            size != header.size) {
+          throw std::runtime_error("corrupt segment " + filename);
+        }
+
+        for(size_t pos = 0; pos < block.size();) {
+          RecordHeader record;
+          memcpy(&record, &block[pos], sizeof(record));
+          pos += sizeof(record);
+
+          std::string host = block.substr(pos, record.hostLength);
+          pos += record.hostLength;
+          std::string path = block.substr(pos, record.pathLength);
+          pos += record.pathLength;
+
+          f(host, path, block.substr(pos, record.dataLength));
+          pos += record.dataLength;
+        }
+      }
+    }
+
+  private:
+    static const size_t BLOCK_SIZE = 256 * 1024;
+    static const int COMPRESSION_LEVEL = 3;
+
+    struct IndexEntry {
+      uint64_t offset;
+      uint64_t length;
+      std::string url;
+    };
+
+    std::string prefix;
+    uint64_t segmentSize;
+    int64_t segment;
+    int logFd, indexFd;
+    uint64_t segmentFill;
+    uint64_t written;
+
+    std::string block, compressed;
+    std::vector<IndexEntry> index;
+
+    std::string segmentName(int64_t n, const char *extension) {
+      std::ostringstream name;
+      name << prefix << '.' << n << extension;
+      return name.str();
+    }
+
+    void openSegment() {
+      closeSegment();
+
+      do ++segment; while(!access(segmentName(segment, ".log").c_str(), F_OK));
+
+      logFd = open(segmentName(segment, ".log").c_str(), O_CREAT | O_EXCL | O_LARGEFILE | O_WRONLY | O_APPEND, 0644);
+      if(logFd < 0) throw std::runtime_error("could not open " + segmentName(segment, ".log") + ": " + strerror(errno));
+
+      indexFd = open(segmentName(segment, ".idx").c_str(), O_CREAT | O_TRUNC | O_LARGEFILE | O_WRONLY | O_APPEND, 0644);
+      if(indexFd < 0) throw std::runtime_error("could not open " + segmentName(segment, ".idx") + ": " + strerror(errno));
+
+      segmentFill = 0;
+    }
+
+    void closeSegment() {
+      if(logFd >= 0) close(logFd);
+      if(indexFd >= 0) close(indexFd);
+      logFd = indexFd = -1;
+    }
+
+    void writeAll(int fd, const char *b, size_t n) {
+      const char *e = b + n;
+      while(b != e) {
+        ssize_t len = write(fd, b, e - b);
+        if(len <= 0) throw std::runtime_error("write failed in weird way: " + std::string(strerror(errno)));
+        b += len;
+      }
+    }
+
+    OutputLog(const OutputLog &);
+};
+
+#endif
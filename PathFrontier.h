@@ -0,0 +1,347 @@
+#ifndef PATHFRONTIER_H
+#define PATHFRONTIER_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <list>
+#include <utility>
+#include <stdexcept>
+#include <cassert>
+#include <unistd.h>
+#include <fcntl.h>
+#include <linux/falloc.h>
+#include <string.h>
+#include <errno.h>
+#include <stdlib.h>
+
+// Temporary file taking the cold segments of all frontiers of a worker once
+// their memory exceeds the budget. Not thread-safe.
+class FrontierSpill {
+  public:
+    FrontierSpill(const std::string &directory, uint64_t budget): budget(budget), used(0), spilled(0), fileSize(0) {
+      fd = open(directory.c_str(), O_TMPFILE | O_RDWR, 0600);
+      if(fd < 0) {
+        std::string name = directory + "/frontier.XXXXXX";
+        fd = mkstemp(&name[0]);
+        if(fd >= 0) unlink(name.c_str());
+      }
+
+      if(fd < 0) throw std::runtime_error("could not create frontier spill file in " + directory + ": " + strerror(errno));
+    }
+
+    ~FrontierSpill() {
+      close(fd);
+    }
+
+    bool isOverBudget() const {
+      return used > static_cast<int64_t>(budget);
+    }
+
+    void account(int64_t delta) {
+      used += delta;
+    }
+
+    uint64_t write(const std::string &data) {
+      uint64_t offset = fileSize;
+
+      for(size_t pos = 0; pos < data.size();) {
+        ssize_t len = pwrite(fd, data.data() + pos, data.size() - pos, offset + pos);
+        if(len <= 0) throw std::runtime_error("frontier spill failed: " + std::string(strerror(errno)));
+        pos += len;
+      }
+
+      fileSize += data.size();
+      spilled += data.size();
+      return offset;
+    }
+
+    void read(uint64_t offset, size_t size, std::string &data) {
+      data.resize(size);
+
+      for(size_t pos = 0; pos < size;) {
+        ssize_t len = pread(fd, &data[pos], size - pos, offset + pos);
+        if(len <= 0) throw std::runtime_error("frontier reload failed: " + std::string(strerror(errno)));
+        pos += len;
+      }
+    }
+
+    // The data written at offset is not needed any more. Its blocks are given
+    // back to the file system (where holes are supported), and the file starts
+    // over once nothing is left in it.
+    void forget(uint64_t offset, uint64_t size) {
+      spilled -= size;
+
+      if(!spilled) {
+        if(!ftruncate(fd, 0)) fileSize = 0;
+      } else {
+        fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, offset, size);
+      }
+    }
+
+    // frontier bytes in memory
+    uint64_t getUsed() const {
+      return used;
+    }
+
+    // frontier bytes currently on disk, i.e. live ones: forgotten ones are
+    // punched out, so the file takes about as much space
+    uint64_t getSpilled() const {
+      return spilled;
+    }
+
+  private:
+    int fd;
+    uint64_t budget;
+    int64_t used;
+    uint64_t spilled;
+    uint64_t fileSize;
+};
+
+// FIFO of URL paths. Paths are front-compressed against their predecessor
+// into segments of about SEGMENT_SIZE bytes, each segment starting from
+// scratch so it can be decoded alone. Only the first few paths (the ones
+// looked at by peek()) are kept as strings. Full segments go to the spill
+// file while it is over budget and come back when they reach the front.
+class PathFrontier {
+  public:
+    PathFrontier(): count(0), readPos(0), memory(0), spill(0) { }
+
+    ~PathFrontier() {
+      clear();
+    }
+
+    void setSpill(FrontierSpill *s) {
+      if(spill) {
+        for(auto &segment: segments) if(segment.spilled) load(segment);
+        spill->account(-memory);
+      }
+
+      spill = s;
+      if(spill) spill->account(memory);
+    }
+
+    bool empty() const {
+      return !count;
+    }
+
+    size_t size() const {
+      return count;
+    }
+
+    // bytes held in memory
+    uint64_t getMemory() const {
+      return memory;
+    }
+
+    void push_back(const std::string &path) {
+      if(segments.empty() || segments.back().spilled || segments.back().data.size() >= SEGMENT_SIZE) {
+        if(!segments.empty()) seal(--segments.end());
+
+        segments.push_back(Segment());
+        lastPushed.clear();
+      }
+
+      Segment &s = segments.back();
+      size_t prefix = 0;
+      while(prefix < lastPushed.length() && prefix < path.length() && lastPushed[prefix] == path[prefix]) ++prefix;
+
+      size_t before = s.data.size();
+      putVarint(s.data, prefix);
+      putVarint(s.data, path.length() - prefix);
+      s.data.append(path, prefix, std::string::npos);
+      ++s.count;
+      ++count;
+
+      adjust(s.data.size() - before);
+      lastPushed = path;
+    }
+
+    const std::string &front() {
+      return peek(0);
+    }
+
+    // the path at position i < size()
+    const std::string &peek(size_t i) {
+      assert(i < count);
+
+      while(window.size() <= i) {
+        Segment &s = segments.front();
+        if(s.spilled) load(s);
+
+        readPos = decode(s.data, readPos, readPath);
+        window.push_back(readPath);
+        adjust(stringMemory(readPath));
+
+        if(!--s.count) {
+          adjust(-static_cast<int64_t>(s.data.size()));
+          segments.pop_front();
+          readPos = 0;
+          readPath.clear();
+          if(segments.empty()) lastPushed.clear();
+        }
+      }
+
+      return window[i];
+    }
+
+    void pop_front() {
+      peek(0);
+
+      // the window only holds the few paths peeked at, so this is cheap
+      adjust(-stringMemory(window.front()));
+      window.erase(window.begin());
+      --count;
+    }
+
+    void clear() {
+      adjust(-memory);
+      for(auto &s: segments) if(s.spilled) spill->forget(s.offset, s.size);
+
+      window.clear();
+      segments.clear();
+      count = 0;
+      readPos = 0;
+      readPath.clear();
+      lastPushed.clear();
+    }
+
+    // calls f(path) for all paths in order
+    template<class F> void each(const F &f) {
+      for(auto &path: window) f(path);
+
+      std::string data, path;
+      for(auto i = segments.begin(); i != segments.end(); ++i) {
+        const Segment &s = *i;
+        if(s.spilled) spill->read(s.offset, s.size, data);
+
+        const std::string &d = s.spilled? data: s.data;
+        size_t pos = 0;
+        path.clear();
+        if(i == segments.begin()) {
+          pos = readPos;
+          path = readPath;
+        }
+
+        for(uint32_t n = 0; n < s.count; ++n) {
+          pos = decode(d, pos, path);
+          f(static_cast<const std::string &>(path));
+        }
+      }
+    }
+
+    // removes all paths matching p, in one pass over the frontier
+    template<class P> void removeIf(const P &p) {
+      PathFrontier kept;
+      kept.setSpill(spill);
+      each([&](const std::string &path) { if(!p(path)) kept.push_back(path); });
+
+      swap(kept);
+    }
+
+    // keeps the first n paths
+    void truncate(size_t n) {
+      if(count <= n) return;
+
+      size_t i = 0;
+      removeIf([&](const std::string &) { return i++ >= n; });
+    }
+
+  private:
+    static const size_t SEGMENT_SIZE = 4096;
+
+    struct Segment {
+      std::string data;
+      uint32_t count;
+      bool spilled;
+      uint64_t offset;
+      uint64_t size;
+
+      Segment(): count(0), spilled(false), offset(0), size(0) { }
+    };
+
+    size_t count;
+    std::vector<std::string> window;
+    std::list<Segment> segments;
+
+    // decoding position in segments.front()
+    size_t readPos;
+    std::string readPath;
+
+    // last path appended to segments.back()
+    std::string lastPushed;
+
+    int64_t memory;
+    FrontierSpill *spill;
+
+    static int64_t stringMemory(const std::string &s) {
+      return sizeof(std::string) + s.length();
+    }
+
+    void adjust(int64_t delta) {
+      memory += delta;
+      if(spill) spill->account(delta);
+    }
+
+    // a segment that will not grow any more, cold unless it is at the front
+    void seal(std::list<Segment>::iterator i) {
+      Segment &s = *i;
+      if(i == segments.begin() || !spill || !spill->isOverBudget()) return;
+
+      s.offset = spill->write(s.data);
+      s.size = s.data.size();
+      s.spilled = true;
+
+      adjust(-static_cast<int64_t>(s.data.size()));
+      std::string().swap(s.data);
+    }
+
+    void load(Segment &s) {
+      spill->read(s.offset, s.size, s.data);
+      spill->forget(s.offset, s.size);
+      s.spilled = false;
+      adjust(s.data.size());
+    }
+
+    void swap(PathFrontier &other) {
+      std::swap(count, other.count);
+      window.swap(other.window);
+      segments.swap(other.segments);
+      std::swap(readPos, other.readPos);
+      readPath.swap(other.readPath);
+      lastPushed.swap(other.lastPushed);
+      std::swap(memory, other.memory);
+    }
+
+    static void putVarint(std::string &data, uint64_t n) {
+      while(n >= 128) {
+        data.push_back(static_cast<char>(n | 128));
+        n >>= 7;
+      }
+
+      data.push_back(static_cast<char>(n));
+    }
+
+    static uint64_t getVarint(const std::string &data, size_t &pos) {
+      uint64_t n = 0;
+      for(int shift = 0; ; shift += 7) {
+        uint8_t b = data[pos++];
+        n |= static_cast<uint64_t>(b & 127) << shift;
+        if(!(b & 128)) return n;
+      }
+    }
+
+    // replaces the end of path according to the entry at pos, returns the next position
+    static size_t decode(const std::string &data, size_t pos, std::string &path) {
+      uint64_t prefix = getVarint(data, pos);
+      uint64_t suffix = getVarint(data, pos);
+
+      path.resize(prefix);
+      path.append(data, pos, suffix);
+      return pos + suffix;
+    }
+
+    PathFrontier(const PathFrontier &);
+};
+
+#endif
@@ -1,24 +1,61 @@
 #ifndef POSTFIXSET_H
 #define POSTFIXSET_H
 
+#include <stdint.h>
 #include <string>
 #include <vector>
-#include <algorithm>
-#include <iostream>
+#include <utility>
 
+// Set of postfixes, stored as a trie of the reversed strings, so a match
+// walks the end of the string once, however many postfixes there are.
 class PostfixSet {
   public:
+    PostfixSet(): nodes(1) { }
+
     void insert(const std::string &postfix) {
-      postfixes.push_back(postfix);
+      uint32_t n = 0;
+      for(auto c = postfix.rbegin(); c != postfix.rend(); ++c) {
+        uint32_t child = find(n, *c);
+        if(!child) {
+          child = nodes.size();
+          nodes[n].children.push_back(std::make_pair(*c, child));
+          nodes.push_back(Node());
+        }
+
+        n = child;
+      }
+
+      nodes[n].terminal = true;
     }
 
     bool matches(const std::string &s) const {
-      for(auto &i: postfixes) if(s.length() >= i.length() && !s.compare(s.length() - i.length(), i.length(), i)) return true;
+      uint32_t n = 0;
+      if(nodes[n].terminal) return true;
+
+      for(auto c = s.rbegin(); c != s.rend(); ++c) {
+        n = find(n, *c);
+        if(!n) return false;
+        if(nodes[n].terminal) return true;
+      }
+
       return false;
     }
 
   private:
-    std::vector<std::string> postfixes;
+    struct Node {
+      std::vector<std::pair<char, uint32_t>> children;
+      bool terminal;
+
+      Node(): terminal(false) { }
+    };
+
+    std::vector<Node> nodes;
+
+    // child of n for c, 0 (the root) if there is none
+    uint32_t find(uint32_t n, char c) const {
+      for(auto &child: nodes[n].children) if(child.first == c) return child.second;
+      return 0;
+    }
 };
 
 #endif
@@ -0,0 +1,246 @@
+#ifndef ROBOTSRULES_H
+#define ROBOTSRULES_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <utility>
+#include <algorithm>
+
+// Allow and Disallow rules of a robots.txt. Patterns match path prefixes,
+// '*' matches any characters and a final '$' the end of the path. The longest
+// matching pattern decides, Allow wins ties.
+//
+// Patterns without '*' form a trie which a path simply walks down. Patterns
+// with '*' form a second trie; as a path can be at several of its positions at
+// once, the sets of positions are the states of a DFA built lazily while
+// matching. Either way a path costs one step per character and trie,
+// independent of the number of rules.
+class RobotsRules {
+  public:
+    RobotsRules() { }
+
+    RobotsRules(const RobotsRules &other): rules(other.rules) {
+      compile();
+    }
+
+    RobotsRules &operator = (const RobotsRules &other) {
+      rules = other.rules;
+      compile();
+      return *this;
+    }
+
+    // an empty pattern ("Disallow:") matches nothing
+    void insert(const std::string &pattern, bool allow) {
+      if(pattern.empty()) return;
+
+      rules.push_back(Rule { pattern, allow });
+      add(pattern, allow);
+      clearStates();
+    }
+
+    bool disallows(const std::string &path) {
+      if(rules.empty()) return false;
+
+      int32_t best = -1;
+      uint32_t n = LITERAL;
+      for(size_t i = 0; ; ++i) {
+        best = std::max(best, nodes[n].match);
+        if(i == path.length()) {
+          best = std::max(best, nodes[n].endMatch);
+          break;
+        }
+
+        n = child(n, path[i]);
+        if(!n) break;
+      }
+
+      if(nodes[WILDCARD].star || !nodes[WILDCARD].children.empty()) {
+        if(states.size() > MAX_STATES) clearStates();
+        if(states.empty()) state(std::vector<uint32_t>(1, WILDCARD));
+
+        uint32_t s = 0;
+        best = std::max(best, states[s].match);
+        for(char c: path) {
+          s = next(s, classes[static_cast<uint8_t>(c)]);
+          if(states[s].nodes.empty()) break;
+
+          best = std::max(best, states[s].match);
+        }
+        best = std::max(best, states[s].endMatch);
+      }
+
+      return best >= 0 && !(best & 1);
+    }
+
+    size_t size() const {
+      return rules.size();
+    }
+
+    // calls f(pattern, allow) for all rules in insertion order
+    template<class F> void each(const F &f) const {
+      for(auto &r: rules) f(r.pattern, r.allow);
+    }
+
+  private:
+    static const size_t MAX_STATES = 4096;
+
+    // roots of the two tries, no node has them as child
+    static const uint32_t LITERAL = 0;
+    static const uint32_t WILDCARD = 1;
+
+    static const uint32_t UNKNOWN = ~0u;
+
+    struct Rule {
+      std::string pattern;
+      bool allow;
+    };
+
+    // Rules ending at a node are scored length * 2 + allow, so the larger
+    // score is the longer rule and Allow wins ties. -1 is no rule.
+    struct Node {
+      std::vector<std::pair<char, uint32_t>> children;
+      uint32_t star;
+      bool isStar;
+      int32_t match;
+      int32_t endMatch;
+
+      Node(bool isStar): star(0), isStar(isStar), match(-1), endMatch(-1) { }
+    };
+
+    struct State {
+      std::vector<uint32_t> nodes;
+      int32_t match;
+      int32_t endMatch;
+    };
+
+    std::vector<Rule> rules;
+    std::vector<Node> nodes;
+
+    // Characters not in any wildcard pattern behave alike, they form class 0.
+    // Every other character has its own class.
+    std::vector<uint16_t> classes;
+    std::string representatives;
+
+    // transitions[s * representatives.size() + class], UNKNOWN if not built yet
+    std::vector<State> states;
+    std::map<std::vector<uint32_t>, uint32_t> stateIds;
+    std::vector<uint32_t> transitions;
+
+    void compile() {
+      nodes.clear();
+      classes.clear();
+      representatives.clear();
+      for(auto &r: rules) add(r.pattern, r.allow);
+      clearStates();
+    }
+
+    void add(const std::string &pattern, bool allow) {
+      if(nodes.empty()) nodes.resize(2, Node(false));
+
+      bool anchored = pattern[pattern.length() - 1] == '$';
+      size_t length = pattern.length() - anchored;
+
+      uint32_t n = LITERAL;
+      if(pattern.find('*') != std::string::npos) {
+        n = WILDCARD;
+
+        if(classes.empty()) {
+          classes.resize(256);
+          representatives.push_back(0);
+        }
+
+        for(size_t i = 0; i < length; ++i) {
+          uint8_t c = pattern[i];
+          if(c == '*' || classes[c]) continue;
+
+          classes[c] = representatives.size();
+          representatives.push_back(c);
+        }
+      }
+      for(size_t i = 0; i < length; ++i) {
+        char c = pattern[i];
+
+        if(c == '*') {
+          if(nodes[n].isStar) continue; // "**" is just "*"
+
+          if(!nodes[n].star) {
+            nodes[n].star = nodes.size();
+            nodes.push_back(Node(true));
+          }
+
+          n = nodes[n].star;
+          continue;
+        }
+
+        uint32_t next = child(n, c);
+        if(!next) {
+          next = nodes.size();
+          nodes[n].children.push_back(std::make_pair(c, next));
+          nodes.push_back(Node(false));
+        }
+
+        n = next;
+      }
+
+      int32_t score = static_cast<int32_t>(pattern.length() * 2 + allow);
+      int32_t &slot = anchored? nodes[n].endMatch: nodes[n].match;
+      slot = std::max(slot, score);
+    }
+
+    void clearStates() {
+      states.clear();
+      stateIds.clear();
+      transitions.clear();
+    }
+
+    // child of n for c, 0 if there is none
+    uint32_t child(uint32_t n, char c) const {
+      for(auto &ch: nodes[n].children) if(ch.first == c) return ch.second;
+      return 0;
+    }
+
+    // the state of a set of trie nodes, which is completed by the '*' nodes
+    // reachable without consuming anything
+    uint32_t state(std::vector<uint32_t> set) {
+      for(size_t i = 0; i < set.size(); ++i) if(nodes[set[i]].star) set.push_back(nodes[set[i]].star);
+
+      std::sort(set.begin(), set.end());
+      set.erase(std::unique(set.begin(), set.end()), set.end());
+
+      auto i = stateIds.find(set);
+      if(i != stateIds.end()) return i->second;
+
+      State s { set, -1, -1 };
+      for(auto n: set) {
+        s.match = std::max(s.match, nodes[n].match);
+        s.endMatch = std::max(s.endMatch, nodes[n].endMatch);
+      }
+
+      uint32_t id = states.size();
+      states.push_back(s);
+      stateIds[set] = id;
+      transitions.resize(states.size() * representatives.size(), static_cast<uint32_t>(UNKNOWN));
+      return id;
+    }
+
+    uint32_t next(uint32_t s, uint16_t c) {
+      uint32_t &t = transitions[s * representatives.size() + c];
+      if(t != UNKNOWN) return t;
+
+      std::vector<uint32_t> set;
+      for(auto n: states[s].nodes) {
+        if(nodes[n].isStar) set.push_back(n);
+
+        uint32_t next = c? child(n, representatives[c]): 0;
+        if(next) set.push_back(next);
+      }
+
+      uint32_t u = state(set);
+      transitions[s * representatives.size() + c] = u;
+      return u;
+    }
+};
+
+#endif
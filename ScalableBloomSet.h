@@ -0,0 +1,148 @@
+#ifndef SCALABLEBLOOMSET_H
+#define SCALABLEBLOOMSET_H
+
+#include "BlockedBloomSet.h"
+
+#include <sys/stat.h>
+#include <sstream>
+#include <string>
+#include <mutex>
+
+// Chain of BlockedBloomSets which grows instead of filling up. Each new layer
+// has twice the capacity of the previous one and 2 more bits per element,
+// which halves its false positive rate, so the total rate stays below twice
+// the rate of the first layer. Old layers are never rehashed.
+//
+// All operations are thread-safe, only adding a layer takes a lock. Processes
+// sharing the files see each other's elements; a layer added by one is opened
+// by the others when their last layer fills up, or on refresh().
+class ScalableBloomSet {
+  public:
+    ScalableBloomSet(uint64_t initialElements): initialElements(initialElements), layerCount(0) {
+      addLayer();
+    }
+
+    // keeps layer i in <filename>.i, reopening all existing layers
+    ScalableBloomSet(uint64_t initialElements, const std::string &filename):
+        initialElements(initialElements), filename(filename), layerCount(0) {
+      do addLayer(); while(layerExists(layerCount));
+    }
+
+    ~ScalableBloomSet() {
+      for(size_t i = 0; i < layerCount; ++i) delete layers[i];
+    }
+
+    bool contains(const char *str, const size_t n) { return contains(hashBytes(str, n)); }
+    bool contains(const std::string &s) { return contains(s.c_str(), s.length()); }
+
+    // return true if the element already existed
+    bool insert(const char *str, const size_t n) { return insert(hashBytes(str, n)); }
+    bool insert(const std::string &s) { return insert(s.c_str(), s.length()); }
+
+    bool contains(uint64_t hash) {
+      for(size_t i = getLayers(); i-- > 0; ) {
+        if(layers[i]->contains(layerHash(hash, i))) return true;
+      }
+
+      return false;
+    }
+
+    bool insert(uint64_t hash) {
+      if(contains(hash)) return true;
+
+      size_t last = getLayers() - 1;
+      if(layers[last]->getElements() >= capacity(last)) {
+        std::lock_guard<std::mutex> lock(growing);
+        if(last == layerCount - 1) addLayer();
+        last = layerCount - 1;
+      }
+
+      return layers[last]->insert(layerHash(hash, last));
+    }
+
+    uint64_t getElements() const {
+      uint64_t elements = 0;
+      for(size_t i = 0; i < getLayers(); ++i) elements += layers[i]->getElements();
+      return elements;
+    }
+
+    uint64_t getCapacity() const {
+      uint64_t total = 0;
+      for(size_t i = 0; i < getLayers(); ++i) total += capacity(i);
+      return total;
+    }
+
+    uint64_t getMemory() const {
+      uint64_t memory = 0;
+      for(size_t i = 0; i < getLayers(); ++i) memory += layers[i]->getMemory();
+      return memory;
+    }
+
+    size_t getLayers() const {
+      return __atomic_load_n(&layerCount, __ATOMIC_ACQUIRE);
+    }
+
+    // fill of the newest layer (0 - 1000), the next insert beyond 1000 adds a layer
+    int getFill() const {
+      size_t last = getLayers() - 1;
+      return layers[last]->getElements() * 1000 / capacity(last);
+    }
+
+    void sync(bool wait = false) {
+      for(size_t i = 0; i < getLayers(); ++i) layers[i]->sync(wait);
+    }
+
+    // opens the layers other processes added in the meantime
+    void refresh() {
+      if(filename.empty()) return;
+
+      std::lock_guard<std::mutex> lock(growing);
+      while(layerExists(layerCount)) addLayer();
+    }
+
+  private:
+    // at 2 more bits per layer, this is far beyond any sensible amount of memory
+    static const int MAX_LAYERS = 48;
+
+    uint64_t initialElements;
+    std::string filename;
+    BlockedBloomSet *layers[MAX_LAYERS];
+    size_t layerCount;
+    std::mutex growing;
+
+    uint64_t capacity(size_t layer) const {
+      return (initialElements? initialElements: 2) << layer;
+    }
+
+    static uint64_t layerHash(uint64_t hash, size_t layer) {
+      return layer? hashFinish(hash, layer): hash;
+    }
+
+    std::string layerFilename(size_t layer) const {
+      std::ostringstream name;
+      name << filename << '.' << layer;
+      return name.str();
+    }
+
+    bool layerExists(size_t layer) const {
+      struct stat st;
+      return stat(layerFilename(layer).c_str(), &st) == 0;
+    }
+
+    void addLayer() {
+      size_t layer = layerCount;
+      if(layer == MAX_LAYERS) throw std::runtime_error("bloom filter cannot grow any further");
+
+      int bitsPerElement = BlockedBloomSet::BITS_PER_ELEMENT + 2 * layer;
+
+      layers[layer] = filename.empty()?
+          new BlockedBloomSet(capacity(layer), bitsPerElement):
+          new BlockedBloomSet(capacity(layer), layerFilename(layer), bitsPerElement);
+
+      __atomic_store_n(&layerCount, layer + 1, __ATOMIC_RELEASE);
+    }
+
+    ScalableBloomSet(const ScalableBloomSet &);
+};
+
+#endif
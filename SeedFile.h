@@ -0,0 +1,231 @@
+#ifndef SEEDFILE_H
+#define SEEDFILE_H
+
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <functional>
+#include <algorithm>
+#include <stdexcept>
+#include <iostream>
+
+#include "HostName.h"
+#include "Hash.h"
+
+// Seed URLs, one per line, read through a mapping of the file: opening it
+// costs the same for any number of seeds. Consecutive URLs of the same host
+// form one group. Hosts are normalized as the crawler knows them (lower case,
+// no default port) and URLs rewritten to match. Every host is handed out
+// once: its later groups in an unsorted file are skipped, so a list sorted by
+// host keeps all URLs. The hosts are remembered exactly, by a hash table of
+// their first lines in the mapping (32 to 64 bytes per host). Blank lines,
+// lines starting with '#' and hosts with invalid ports are skipped. Not
+// thread-safe, HostFrontier serializes the access.
+class SeedFile {
+  public:
+    // continues at offset, as returned by getOffset() of an earlier run;
+    // groups are cut after maxUrls URLs, the rest of their URLs is skipped
+    SeedFile(const std::string &filename, uint64_t offset, size_t maxUrls): data(0), size(0), position(offset), maxUrls(maxUrls), indexed(false), hosts(0) {
+      int fd = open(filename.c_str(), O_RDONLY);
+      if(fd < 0) throw std::runtime_error("could not open " + filename + ": " + strerror(errno));
+
+      struct stat st;
+      if(fstat(fd, &st) < 0) {
+        close(fd);
+        throw std::runtime_error("could not stat " + filename + ": " + strerror(errno));
+      }
+
+      size = st.st_size;
+      if(size) {
+        void *mapped = mmap(0, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(mapped == MAP_FAILED) {
+          close(fd);
+          throw std::runtime_error("could not map " + filename + ": " + strerror(errno));
+        }
+
+        data = static_cast<const char *>(mapped);
+        madvise(mapped, size, MADV_SEQUENTIAL);
+      }
+      close(fd);
+
+      if(position > size) position = size;
+    }
+
+    ~SeedFile() {
+      if(data) munmap(const_cast<char *>(data), size);
+    }
+
+    // groups of hosts for which accept(host) is false are skipped (other shards' seeds)
+    void setFilter(const std::function<bool(const std::string &)> &accept) {
+      filter = accept;
+    }
+
+    // the next group into host and urls, false once the file is done
+    bool next(std::string &host, std::vector<std::string> &urls) {
+      index();
+
+      Line line;
+      while(peek(line)) {
+        uint64_t start = position;
+        if(readGroup(line, host, &urls) && (!filter || filter(host)) && remember(host, start)) return true;
+      }
+
+      return false;
+    }
+
+    // true if a group of host was handed out already (by an earlier run, too)
+    bool contains(const std::string &host) {
+      index();
+      return find(host, hashBytes(host.data(), host.length())) != 0;
+    }
+
+    bool isExhausted() {
+      Line line;
+      return !peek(line);
+    }
+
+    // start of the groups not returned yet
+    uint64_t getOffset() const { return position; }
+    uint64_t getSize() const { return size; }
+
+  private:
+    const char *data;
+    uint64_t size;
+    uint64_t position;
+    size_t maxUrls;
+    std::function<bool(const std::string &)> filter;
+    std::string lineHost, storedHost;
+
+    // the hosts handed out, by the offset of their first line plus one (0 is free)
+    struct Slot {
+      uint64_t hash;
+      uint64_t line;
+    };
+
+    std::vector<Slot> slots;
+    bool indexed;
+    uint64_t hosts;
+
+    struct Line {
+      const char *url, *urlEnd, *host, *hostEnd;
+      uint64_t next;
+    };
+
+    // The line at offset, false if it has no URL. Its end is known in any case.
+    bool lineAt(uint64_t offset, Line &line) const {
+      const char *end = data + size;
+      const char *b = data + offset;
+      const char *e = static_cast<const char *>(memchr(b, '\n', end - b));
+      if(!e) e = end;
+      line.next = e - data + (e != end);
+
+      while(b != e && isspace(static_cast<unsigned char>(*b))) ++b;
+      while(e != b && isspace(static_cast<unsigned char>(e[-1]))) --e;
+
+      const char *scheme = b == e || *b == '#'? 0: static_cast<const char *>(memmem(b, e - b, "://", 3));
+      if(!scheme) return false;
+
+      line.url = b;
+      line.urlEnd = e;
+      line.host = scheme + 3;
+      line.hostEnd = std::find(line.host, e, '/');
+      return line.host != line.hostEnd;
+    }
+
+    // Finds the next URL and its host, moving the position past lines without
+    // one. The URL itself is not consumed.
+    bool peek(Line &line) {
+      for(; position < size; position = line.next) if(lineAt(position, line)) return true;
+      return false;
+    }
+
+    // Moves the position past the group starting with line, collecting its
+    // URLs unless urls is 0. False if its host is invalid.
+    bool readGroup(Line &line, std::string &host, std::vector<std::string> *urls) {
+      host.assign(line.host, line.hostEnd);
+      if(!normalizeHost(host)) {
+        if(urls) std::cerr << "Invalid seed: " << std::string(line.url, line.urlEnd) << std::endl;
+        position = line.next;
+        return false;
+      }
+
+      if(urls) urls->clear();
+      do {
+        if(urls && urls->size() < maxUrls) urls->push_back(std::string(line.url, line.host) + host + std::string(line.hostEnd, line.urlEnd));
+        position = line.next;
+        if(!peek(line)) break;
+        lineHost.assign(line.host, line.hostEnd);
+      } while(normalizeHost(lineHost) && lineHost == host);
+
+      return true;
+    }
+
+    // the hosts of the groups before the offset an earlier run stopped at
+    void index() {
+      if(indexed) return;
+      indexed = true;
+
+      uint64_t end = position;
+      std::string host;
+      Line line;
+      for(position = 0; position < end && peek(line);) {
+        uint64_t start = position;
+        if(readGroup(line, host, 0) && (!filter || filter(host))) remember(host, start);
+      }
+      position = end;
+    }
+
+    // the slot of host, 0 if it is not there
+    Slot *find(const std::string &host, uint64_t hash) {
+      if(slots.empty()) return 0;
+
+      for(size_t i = hash & (slots.size() - 1);; i = (i + 1) & (slots.size() - 1)) {
+        Slot &s = slots[i];
+        if(!s.line) return 0;
+
+        if(s.hash != hash) continue;
+        Line line;
+        if(!lineAt(s.line - 1, line)) continue;
+        storedHost.assign(line.host, line.hostEnd);
+        normalizeHost(storedHost);
+        if(storedHost == host) return &s;
+      }
+    }
+
+    // false if host was handed out already
+    bool remember(const std::string &host, uint64_t start) {
+      uint64_t hash = hashBytes(host.data(), host.length());
+      if(find(host, hash)) return false;
+
+      if(2 * (hosts + 1) > slots.size()) grow();
+      size_t i = hash & (slots.size() - 1);
+      while(slots[i].line) i = (i + 1) & (slots.size() - 1);
+      slots[i] = Slot { hash, start + 1 };
+      ++hosts;
+      return true;
+    }
+
+    void grow() {
+      std::vector<Slot> old(std::max<size_t>(1024, 2 * slots.size()), Slot { 0, 0 });
+      old.swap(slots);
+
+      for(auto &s: old) {
+        if(!s.line) continue;
+        size_t i = s.hash & (slots.size() - 1);
+        while(slots[i].line) i = (i + 1) & (slots.size() - 1);
+        slots[i] = s;
+      }
+    }
+
+    SeedFile(const SeedFile &);
+};
+
+#endif
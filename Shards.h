@@ -0,0 +1,570 @@
+#ifndef SHARDS_H
+#define SHARDS_H
+
+#include "Hash.h"
+#include "HostFrontier.h"
+#include "ScalableBloomSet.h"
+#include "TimerWheel.h"
+#include "Metrics.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+
+// Connects the processes of a sharded crawl. Every host belongs to exactly one
+// shard; links to hosts of other shards are sent to their owner, and new line
+// hashes can be sent to all shards, for those not sharing a seen lines file.
+//
+// Shards talk over TCP, each listening on its own address and connecting to
+// all others. A frame is a type byte, a 32 bit length and the payload, all in
+// host byte order (so every shard has to run on the same architecture):
+//   'I' shard, session (64 bit each)
+//                             the sender, first on every connection
+//   'U' sequence (64 bit), host, ' ', path
+//                             a link to a host of the receiving shard
+//   'H' 64 bit hashes         lines seen by the sender
+//   'S' shard, idle, sent, received (64 bit each)
+//                             the sender's state, every STATE_MILLISECONDS
+//
+// The receiver acknowledges links by writing back the 64 bit sequence of the
+// last one it took from the sender. A link only counts as sent once it is
+// acknowledged: links a broken connection lost are sent again on the next one
+// (along with the frame it broke off in), and the receiver skips those it had.
+// Discovery only ends when all shards are idle and every host sent has been
+// received, twice in a row; until then the frontier is held.
+class Shards {
+  public:
+    // peers holds "ip:port" of every shard in shard order, the own one is listened on
+    Shards(uint64_t index, const std::vector<std::string> &peers): index(index), hostFrontier(0), seenLines(0),
+        running(false), sentHosts(0), receivedHosts(0), lastSent(0), lastReceived(0), lastIdle(false),
+        hostsSent(0), hostsReceived(0), linesReceived(0) {
+      if(index >= peers.size()) throw std::runtime_error("shard " + std::to_string(index) + " has no shardPeer");
+
+      for(auto &p: peers) {
+        Peer peer;
+        peer.address = p;
+        peer.addr = parseAddress(p);
+        peer.fd = -1;
+        peer.connected = false;
+        peer.retryAt = 0;
+        peer.stateKnown = peer.idle = false;
+        peer.sent = peer.received = 0;
+        peer.sequence = 0;
+        peer.written = 0;
+        this->peers.push_back(peer);
+      }
+
+      // tells a restarted shard from a reconnecting one
+      timespec now;
+      clock_gettime(CLOCK_REALTIME, &now);
+      session = hashWord(hashWord(HASH_SEED, getpid()), now.tv_sec * 1000000000ull + now.tv_nsec);
+      sessions.assign(peers.size(), 0);
+      delivered.assign(peers.size(), 0);
+
+      listener = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+      int one = 1;
+      setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+      if(listener < 0 || bind(listener, reinterpret_cast<sockaddr *>(&this->peers[index].addr), sizeof(sockaddr_in)) < 0 ||
+          listen(listener, 64) < 0) {
+        std::string error = strerror(errno);
+        if(listener >= 0) close(listener);
+        throw std::runtime_error("could not listen on " + peers[index] + ": " + error);
+      }
+    }
+
+    ~Shards() {
+      running = false;
+      if(thread.joinable()) thread.join();
+
+      close(listener);
+      for(auto &p: peers) if(p.fd >= 0) close(p.fd);
+      for(auto &in: inbound) close(in.fd);
+    }
+
+    static uint64_t shardOf(const std::string &host, uint64_t count) {
+      // rehashed, as workers are picked by hashBytes(host) % threads
+      return hashFinish(hashBytes(host.data(), host.length()), SHARD_SALT) % count;
+    }
+
+    bool owns(const std::string &host) const {
+      return shardOf(host, peers.size()) == index;
+    }
+
+    uint64_t getIndex() const { return index; }
+    uint64_t getCount() const { return peers.size(); }
+
+    // exchanged hosts and lines are counted here
+    void setMetrics(Metrics &metrics) {
+      hostsSent = &metrics.counter("crawler_shard_hosts_sent_total", "Hosts sent to the shards owning them.");
+      hostsReceived = &metrics.counter("crawler_shard_hosts_received_total", "Hosts received from other shards.");
+      linesReceived = &metrics.counter("crawler_shard_lines_received_total", "Line hashes received from other shards.");
+    }
+
+    // Hosts received go to the frontier, which is held until all shards are
+    // done, and line hashes to lines.
+    void start(HostFrontier *frontier, ScalableBloomSet *lines) {
+      hostFrontier = frontier;
+      seenLines = lines;
+
+      hostFrontier->hold(true);
+      running = true;
+      thread = std::thread([this] { run(); });
+    }
+
+    // Queues a link to a host of another shard for its owner, false for own
+    // hosts. Dropped if the owner is too far behind.
+    bool forwardHost(const std::string &host, const std::string &path) {
+      uint64_t shard = shardOf(host, peers.size());
+      if(shard == index) return false;
+
+      std::lock_guard<std::mutex> lock(mutex);
+      Peer &p = peers[shard];
+      if(p.out.size() > MAX_BUFFERED) return true;
+
+      uint64_t sequence = ++p.sequence;
+      appendFrame(p.out, 'U', sizeof(sequence) + host.length() + 1 + path.length());
+      p.out.append(reinterpret_cast<const char *>(&sequence), sizeof(sequence));
+      p.out.append(host);
+      p.out.push_back(' ');
+      p.out.append(path);
+      if(hostsSent) hostsSent->add();
+      return true;
+    }
+
+    // a line not seen before, sent to all other shards with the next batch
+    void forwardLine(uint64_t hash) {
+      std::lock_guard<std::mutex> lock(mutex);
+      lines.push_back(hash);
+    }
+
+  private:
+    static const uint64_t SHARD_SALT = 0x5348415244ull;
+    static const uint64_t STATE_MILLISECONDS = 500;
+    static const uint64_t RETRY_MILLISECONDS = 1000;
+    static const size_t MAX_BUFFERED = 64 * 1024 * 1024;
+    static const uint32_t MAX_FRAME = 1024 * 1024;
+    static const size_t HEADER_SIZE = 5;
+
+    struct Peer {
+      std::string address;
+      sockaddr_in addr;
+
+      // outgoing connection, with the frames not yet sent (written bytes of
+      // them went out on the current connection) and the links not yet
+      // acknowledged
+      int fd;
+      bool connected;
+      uint64_t retryAt;
+      std::string out;
+      size_t written;
+      std::string unacked;
+      std::string acks;
+      uint64_t sequence;
+
+      // as of its last state frame
+      bool stateKnown, idle;
+      uint64_t sent, received;
+    };
+
+    // a connection of another shard, with the acknowledgements not yet sent
+    struct Inbound {
+      int fd;
+      std::string in;
+      uint64_t shard;
+      std::string out;
+      bool acknowledge;
+    };
+
+    uint64_t index;
+    std::vector<Peer> peers;
+    std::vector<Inbound> inbound;
+    int listener;
+
+    HostFrontier *hostFrontier;
+    ScalableBloomSet *seenLines;
+
+    std::thread thread;
+    std::atomic<bool> running;
+
+    // guards the output buffers, lines and sentHosts
+    std::mutex mutex;
+    std::vector<uint64_t> lines;
+    uint64_t sentHosts;
+    uint64_t receivedHosts;
+
+    // per sending shard, its session and the sequence of the last link taken
+    uint64_t session;
+    std::vector<uint64_t> sessions, delivered;
+
+    // the global state at the previous check
+    uint64_t lastSent, lastReceived;
+    bool lastIdle;
+
+    Counter *hostsSent, *hostsReceived, *linesReceived;
+
+    static sockaddr_in parseAddress(const std::string &address) {
+      sockaddr_in addr;
+      memset(&addr, 0, sizeof(addr));
+      addr.sin_family = AF_INET;
+
+      size_t colon = address.rfind(':');
+      if(colon == std::string::npos || inet_pton(AF_INET, address.substr(0, colon).c_str(), &addr.sin_addr) != 1) {
+        throw std::runtime_error("invalid shard address (ip:port): " + address);
+      }
+
+      addr.sin_port = htons(atoi(address.c_str() + colon + 1));
+      return addr;
+    }
+
+    static void appendFrame(std::string &out, char type, uint32_t length) {
+      out.push_back(type);
+      out.append(reinterpret_cast<const char *>(&length), sizeof(length));
+    }
+
+    void run() {
+      uint64_t lastState = 0;
+      std::vector<pollfd> fds;
+
+      while(running) {
+        uint64_t now = monotonicMilliseconds();
+
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+          for(size_t b = 0; b < lines.size(); b += MAX_FRAME / sizeof(uint64_t)) {
+            size_t length = std::min<size_t>(lines.size() - b, MAX_FRAME / sizeof(uint64_t)) * sizeof(uint64_t);
+
+            for(uint64_t i = 0; i < peers.size(); ++i) {
+              if(i == index || peers[i].out.size() > MAX_BUFFERED) continue;
+
+              appendFrame(peers[i].out, 'H', length);
+              peers[i].out.append(reinterpret_cast<const char *>(lines.data() + b), length);
+            }
+          }
+          lines.clear();
+        }
+
+        if(now >= lastState + STATE_MILLISECONDS) {
+          checkDone();
+          lastState = now;
+        }
+
+        for(uint64_t i = 0; i < peers.size(); ++i) {
+          if(i != index && peers[i].fd < 0 && now >= peers[i].retryAt) connectPeer(peers[i]);
+        }
+
+        fds.clear();
+        fds.push_back(pollfd { listener, POLLIN, 0 });
+        for(auto &in: inbound) fds.push_back(pollfd { in.fd, static_cast<short>(POLLIN | (in.out.empty()? 0: POLLOUT)), 0 });
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+          for(auto &p: peers) {
+            if(p.fd >= 0) fds.push_back(pollfd { p.fd, static_cast<short>(POLLIN | (!p.connected || !p.out.empty()? POLLOUT: 0)), 0 });
+          }
+        }
+
+        if(poll(fds.data(), fds.size(), 100) < 0 && errno != EINTR) throw std::runtime_error("poll failed: " + std::string(strerror(errno)));
+
+        size_t f = 1;
+        for(size_t i = 0; i < inbound.size(); ++f) {
+          if(fds[f].revents && !receive(inbound[i])) {
+            close(inbound[i].fd);
+            inbound.erase(inbound.begin() + i);
+          } else {
+            ++i;
+          }
+        }
+
+        for(auto &p: peers) {
+          if(p.fd < 0) continue;
+
+          short events = fds[f++].revents;
+          if((events & (POLLERR | POLLHUP)) || ((events & POLLIN) && !receiveAcks(p))) {
+            disconnect(p);
+          } else if(events & POLLOUT) {
+            send(p);
+          }
+        }
+
+        // last, the new connections have no entry in fds yet
+        if(fds[0].revents & POLLIN) acceptPeers();
+      }
+    }
+
+    // tells the others how this shard is doing and releases the frontier once all are done
+    void checkDone() {
+      bool idle = hostFrontier->isIdle();
+      uint64_t sent, received = receivedHosts;
+
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        sent = sentHosts;
+
+        uint64_t state[4] = { index, idle, sentHosts, receivedHosts };
+        for(uint64_t i = 0; i < peers.size(); ++i) {
+          if(i == index) continue;
+
+          idle &= peers[i].out.empty() && peers[i].unacked.empty();
+          appendFrame(peers[i].out, 'S', sizeof(state));
+          peers[i].out.append(reinterpret_cast<const char *>(state), sizeof(state));
+        }
+      }
+
+      for(uint64_t i = 0; i < peers.size(); ++i) {
+        if(i == index) continue;
+
+        idle &= peers[i].stateKnown && peers[i].idle;
+        sent += peers[i].sent;
+        received += peers[i].received;
+      }
+
+      bool done = idle && lastIdle && sent == received && sent == lastSent && received == lastReceived;
+      hostFrontier->hold(!done);
+
+      lastIdle = idle;
+      lastSent = sent;
+      lastReceived = received;
+    }
+
+    void connectPeer(Peer &p) {
+      p.fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+      p.connected = false;
+
+      if(p.fd < 0 || (connect(p.fd, reinterpret_cast<sockaddr *>(&p.addr), sizeof(p.addr)) < 0 && errno != EINPROGRESS)) {
+        disconnect(p);
+        return;
+      }
+
+      uint64_t hello[2] = { index, session };
+      std::string frame;
+      appendFrame(frame, 'I', sizeof(hello));
+      frame.append(reinterpret_cast<const char *>(hello), sizeof(hello));
+
+      std::lock_guard<std::mutex> lock(mutex);
+      p.out.insert(0, frame);
+    }
+
+    // Unsent frames are kept for the next connection, whole, after the links
+    // not acknowledged. A greeting not sent yet goes, the next connection has
+    // its own.
+    void disconnect(Peer &p) {
+      if(p.fd >= 0) close(p.fd);
+      p.fd = -1;
+      p.connected = false;
+      p.retryAt = monotonicMilliseconds() + RETRY_MILLISECONDS;
+
+      std::lock_guard<std::mutex> lock(mutex);
+      if(!p.written && !p.out.empty() && p.out[0] == 'I') p.out.erase(0, HEADER_SIZE + 2 * sizeof(uint64_t));
+      p.out.insert(0, p.unacked);
+      p.unacked.clear();
+      p.written = 0;
+      p.acks.clear();
+    }
+
+    void send(Peer &p) {
+      if(!p.connected) {
+        int error = 0;
+        socklen_t length = sizeof(error);
+        if(getsockopt(p.fd, SOL_SOCKET, SO_ERROR, &error, &length) < 0 || error) {
+          disconnect(p);
+          return;
+        }
+
+        p.connected = true;
+      }
+
+      std::unique_lock<std::mutex> lock(mutex);
+      if(p.out.empty()) return;
+
+      ssize_t n = ::send(p.fd, p.out.data() + p.written, p.out.size() - p.written, MSG_DONTWAIT | MSG_NOSIGNAL);
+      if(n < 0) {
+        if(errno != EAGAIN && errno != EWOULDBLOCK) {
+          lock.unlock();
+          std::cerr << "shard " << p.address << ": " << strerror(errno) << std::endl;
+          disconnect(p);
+        }
+        return;
+      }
+
+      // frames sent completely are done with, links once acknowledged
+      p.written += n;
+      size_t pos = 0;
+      while(p.written - pos >= HEADER_SIZE) {
+        uint32_t length;
+        memcpy(&length, p.out.data() + pos + 1, sizeof(length));
+        if(p.written - pos < HEADER_SIZE + length) break;
+
+        if(p.out[pos] == 'U') p.unacked.append(p.out, pos, HEADER_SIZE + length);
+        pos += HEADER_SIZE + length;
+      }
+
+      p.out.erase(0, pos);
+      p.written -= pos;
+    }
+
+    // false once the connection is closed or broken
+    bool receiveAcks(Peer &p) {
+      char buffer[4096];
+      ssize_t n = recv(p.fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+      if(n == 0) return false;
+      if(n < 0) return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+
+      p.acks.append(buffer, n);
+      size_t whole = p.acks.size() / sizeof(uint64_t) * sizeof(uint64_t);
+      if(!whole) return true;
+
+      uint64_t acknowledged;
+      memcpy(&acknowledged, p.acks.data() + whole - sizeof(acknowledged), sizeof(acknowledged));
+      p.acks.erase(0, whole);
+
+      std::lock_guard<std::mutex> lock(mutex);
+      size_t pos = 0;
+      while(pos < p.unacked.size()) {
+        uint32_t length;
+        uint64_t sequence;
+        memcpy(&length, p.unacked.data() + pos + 1, sizeof(length));
+        memcpy(&sequence, p.unacked.data() + pos + HEADER_SIZE, sizeof(sequence));
+        if(sequence > acknowledged) break;
+
+        pos += HEADER_SIZE + length;
+        ++sentHosts;
+      }
+
+      p.unacked.erase(0, pos);
+      return true;
+    }
+
+    void acceptPeers() {
+      int fd;
+      while((fd = accept4(listener, 0, 0, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+        inbound.push_back(Inbound { fd, std::string(), peers.size(), std::string(), false });
+      }
+    }
+
+    // false once the connection is closed or broken
+    bool receive(Inbound &in) {
+      char buffer[64 * 1024];
+      ssize_t n = recv(in.fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+      if(n == 0) return false;
+      if(n < 0) return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) && sendAcks(in);
+
+      in.in.append(buffer, n);
+
+      size_t pos = 0;
+      while(in.in.size() - pos >= HEADER_SIZE) {
+        uint32_t length;
+        memcpy(&length, in.in.data() + pos + 1, sizeof(length));
+        if(length > MAX_FRAME) {
+          std::cerr << "shard frame too large" << std::endl;
+          return false;
+        }
+
+        if(in.in.size() - pos - HEADER_SIZE < length) break;
+
+        if(!handleFrame(in, in.in[pos], in.in.data() + pos + HEADER_SIZE, length)) return false;
+        pos += HEADER_SIZE + length;
+      }
+
+      in.in.erase(0, pos);
+
+      if(in.acknowledge) {
+        in.out.append(reinterpret_cast<const char *>(&delivered[in.shard]), sizeof(uint64_t));
+        in.acknowledge = false;
+      }
+      return sendAcks(in);
+    }
+
+    bool sendAcks(Inbound &in) {
+      if(in.out.empty()) return true;
+
+      ssize_t n = ::send(in.fd, in.out.data(), in.out.size(), MSG_DONTWAIT | MSG_NOSIGNAL);
+      if(n < 0) return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+
+      in.out.erase(0, n);
+      return true;
+    }
+
+    bool handleFrame(Inbound &in, char type, const char *b, uint32_t length) {
+      switch(type) {
+        case 'I': {
+          uint64_t hello[2];
+          if(length != sizeof(hello)) return false;
+          memcpy(hello, b, sizeof(hello));
+          if(hello[0] >= peers.size() || hello[0] == index) return false;
+
+          in.shard = hello[0];
+          if(sessions[in.shard] != hello[1]) {
+            sessions[in.shard] = hello[1];
+            delivered[in.shard] = 0;
+          }
+          return true;
+        }
+
+        case 'U': {
+          uint64_t sequence;
+          if(in.shard >= peers.size() || length < sizeof(sequence)) return false;
+          memcpy(&sequence, b, sizeof(sequence));
+
+          const char *host = b + sizeof(sequence);
+          const char *space = static_cast<const char *>(memchr(host, ' ', b + length - host));
+          if(!space) return false;
+
+          // sent again after a broken connection, and already taken
+          in.acknowledge = true;
+          if(sequence <= delivered[in.shard]) return true;
+
+          delivered[in.shard] = sequence;
+          hostFrontier->discover(std::string(host, space), std::string(space + 1, b + length));
+          ++receivedHosts;
+          if(hostsReceived) hostsReceived->add();
+          return true;
+        }
+
+        case 'H':
+          for(uint32_t i = 0; i + sizeof(uint64_t) <= length; i += sizeof(uint64_t)) {
+            uint64_t hash;
+            memcpy(&hash, b + i, sizeof(hash));
+            seenLines->insert(hash);
+          }
+          if(linesReceived) linesReceived->add(length / sizeof(uint64_t));
+          return true;
+
+        case 'S': {
+          uint64_t state[4];
+          if(length != sizeof(state)) return false;
+          memcpy(state, b, sizeof(state));
+          if(state[0] >= peers.size() || state[0] == index) return false;
+
+          Peer &p = peers[state[0]];
+          p.stateKnown = true;
+          p.idle = state[1];
+          p.sent = state[2];
+          p.received = state[3];
+          return true;
+        }
+
+        default:
+          std::cerr << "unknown shard frame: " << type << std::endl;
+          return false;
+      }
+    }
+
+    Shards(const Shards &);
+};
+
+#endif
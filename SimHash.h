@@ -0,0 +1,124 @@
+#ifndef SIMHASH_H
+#define SIMHASH_H
+
+#include <stdint.h>
+#include <vector>
+#include <mutex>
+#include <algorithm>
+#include <stdexcept>
+
+// Streaming SimHash of a page: every line hash votes on each of the 64 bits,
+// pages sharing most of their lines end up with fingerprints differing in
+// few bits.
+class SimHash {
+  public:
+    SimHash() {
+      reset();
+    }
+
+    void reset() {
+      std::fill(votes, votes + 64, 0);
+      lines = 0;
+    }
+
+    void add(uint64_t hash) {
+      for(int i = 0; i < 64; ++i) votes[i] += (hash >> i & 1)? 1: -1;
+      ++lines;
+    }
+
+    uint64_t get() const {
+      uint64_t fingerprint = 0;
+      for(int i = 0; i < 64; ++i) if(votes[i] > 0) fingerprint |= 1ull << i;
+      return fingerprint;
+    }
+
+    uint64_t getLines() const {
+      return lines;
+    }
+
+  private:
+    int32_t votes[64];
+    uint64_t lines;
+};
+
+// Page fingerprints of all workers, for near-duplicate lookups. Two
+// fingerprints within maxDistance bits agree completely in at least one of
+// maxDistance + 1 blocks, so there is one hash table per block. Once capacity fingerprints are stored the index starts over.
+// Thread-safe.
+class SimHashIndex {
+  public:
+    SimHashIndex(uint64_t capacity, int maxDistance):
+        capacity(std::min<uint64_t>(capacity, UINT32_MAX - 1)), maxDistance(maxDistance), blocks(maxDistance + 1),
+        heads(blocks << BUCKET_BITS), duplicates(0) {
+      if(maxDistance < 0 || maxDistance > 31) throw std::runtime_error("near duplicate distance out of range");
+
+      entries.push_back(0); // index 0 ends the chains
+      next.resize(blocks);
+    }
+
+    // true if a near-duplicate of fingerprint is known, otherwise adds it
+    bool check(uint64_t fingerprint) {
+      std::lock_guard<std::mutex> lock(mutex);
+
+      for(int t = 0; t < blocks; ++t) {
+        for(uint32_t e = heads[bucket(fingerprint, t)]; e; e = next[e * blocks + t]) {
+          if(__builtin_popcountll(entries[e] ^ fingerprint) <= maxDistance) {
+            ++duplicates;
+            return true;
+          }
+        }
+      }
+
+      if(entries.size() > capacity) {
+        std::fill(heads.begin(), heads.end(), 0);
+        entries.resize(1);
+        next.resize(blocks);
+      }
+
+      uint32_t e = entries.size();
+      entries.push_back(fingerprint);
+      for(int t = 0; t < blocks; ++t) {
+        uint32_t &head = heads[bucket(fingerprint, t)];
+        next.push_back(head);
+        head = e;
+      }
+
+      return false;
+    }
+
+    uint64_t getSize() {
+      std::lock_guard<std::mutex> lock(mutex);
+      return entries.size() - 1;
+    }
+
+    // near-duplicates found so far
+    uint64_t getDuplicates() {
+      std::lock_guard<std::mutex> lock(mutex);
+      return duplicates;
+    }
+
+  private:
+    static const int BUCKET_BITS = 16;
+
+    uint64_t capacity;
+    int maxDistance;
+    int blocks;
+
+    std::mutex mutex;
+    std::vector<uint32_t> heads;
+    std::vector<uint64_t> entries;
+    std::vector<uint32_t> next; // next[e * blocks + t] follows e in table t
+    uint64_t duplicates;
+
+    // bucket in table t, from the bits of block t
+    uint32_t bucket(uint64_t fingerprint, int t) const {
+      int width = 64 / blocks;
+      int shift = t * width;
+      uint64_t block = fingerprint >> shift;
+      if(t != blocks - 1) block &= (1ull << width) - 1;
+
+      return (t << BUCKET_BITS) + ((block + t) * 0x9e3779b97f4a7c15ull >> (64 - BUCKET_BITS));
+    }
+};
+
+#endif
@@ -0,0 +1,100 @@
+#ifndef SOCKETADDRESS_H
+#define SOCKETADDRESS_H
+
+#include "Hash.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <string>
+
+// IPv4 or IPv6 address of a server, with its port.
+class SocketAddress {
+  public:
+    SocketAddress() {
+      memset(&addr, 0, sizeof(addr));
+      addr.v4.sin_family = AF_INET;
+    }
+
+    // ip in network byte order
+    static SocketAddress ipv4(uint32_t ip, uint16_t port) {
+      SocketAddress a;
+      a.addr.v4.sin_addr.s_addr = ip;
+      a.setPort(port);
+      return a;
+    }
+
+    // copies an AF_INET or AF_INET6 address, false for any other family
+    bool assign(const sockaddr *sa) {
+      if(sa->sa_family == AF_INET) {
+        memcpy(&addr.v4, sa, sizeof(addr.v4));
+      } else if(sa->sa_family == AF_INET6) {
+        memcpy(&addr.v6, sa, sizeof(addr.v6));
+      } else {
+        return false;
+      }
+
+      return true;
+    }
+
+    // dotted IPv4 or textual IPv6 address, without port
+    bool parse(const std::string &text) {
+      SocketAddress a;
+      if(inet_pton(AF_INET, text.c_str(), &a.addr.v4.sin_addr) == 1) {
+        *this = a;
+        return true;
+      }
+
+      a.addr.v6.sin6_family = AF_INET6;
+      if(inet_pton(AF_INET6, text.c_str(), &a.addr.v6.sin6_addr) == 1) {
+        *this = a;
+        return true;
+      }
+
+      return false;
+    }
+
+    std::string toString() const {
+      char text[INET6_ADDRSTRLEN];
+      if(isIpv6()) {
+        inet_ntop(AF_INET6, &addr.v6.sin6_addr, text, sizeof(text));
+      } else {
+        inet_ntop(AF_INET, &addr.v4.sin_addr, text, sizeof(text));
+      }
+
+      return text;
+    }
+
+    void setPort(uint16_t port) {
+      // at the same place in both
+      addr.v4.sin_port = htons(port);
+    }
+
+    bool isIpv6() const { return addr.any.sa_family == AF_INET6; }
+    int getFamily() const { return addr.any.sa_family; }
+    const sockaddr *get() const { return &addr.any; }
+    socklen_t getLength() const { return isIpv6()? sizeof(addr.v6): sizeof(addr.v4); }
+
+    // identifies the server (the port aside), the address itself for IPv4
+    uint64_t getServer() const {
+      if(!isIpv6()) return addr.v4.sin_addr.s_addr;
+      return hashBytes(reinterpret_cast<const char *>(&addr.v6.sin6_addr), sizeof(addr.v6.sin6_addr));
+    }
+
+    bool operator==(const SocketAddress &other) const {
+      if(getFamily() != other.getFamily() || addr.v4.sin_port != other.addr.v4.sin_port) return false;
+      if(isIpv6()) return !memcmp(&addr.v6.sin6_addr, &other.addr.v6.sin6_addr, sizeof(addr.v6.sin6_addr));
+      return addr.v4.sin_addr.s_addr == other.addr.v4.sin_addr.s_addr;
+    }
+
+  private:
+    union {
+      sockaddr any;
+      sockaddr_in v4;
+      sockaddr_in6 v6;
+    } addr;
+};
+
+#endif
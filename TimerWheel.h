@@ -0,0 +1,108 @@
+#ifndef TIMERWHEEL_H
+#define TIMERWHEEL_H
+
+#include <stdint.h>
+#include <time.h>
+#include <vector>
+
+inline uint64_t monotonicMilliseconds() {
+  timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000ull + now.tv_nsec / 1000000;
+}
+
+inline uint64_t monotonicMicroseconds() {
+  timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000000ull + now.tv_nsec / 1000;
+}
+
+// Hierarchical timer wheel with millisecond ticks: 4 levels of 256 slots
+// cover 49 days, timers further out are parked in the last level and simply
+// cascade again. Scheduling and expiring are O(1) per timer.
+class TimerWheel {
+  public:
+    TimerWheel(uint64_t now): current(now), size(0) { }
+
+    void schedule(uint64_t when, uint64_t id) {
+      insert(Timer { when, id });
+      ++size;
+    }
+
+    bool empty() const {
+      return !size;
+    }
+
+    // calls f(id, when) for all timers due at now
+    template<class F> void expire(uint64_t now, const F &f) {
+      while(current <= now) {
+        if(!size) {
+          current = now + 1;
+          break;
+        }
+
+        std::vector<Timer> &slot = slots[0][current & (SLOTS - 1)];
+        while(!slot.empty()) {
+          Timer timer = slot.back();
+          slot.pop_back();
+          --size;
+
+          f(timer.id, timer.when);
+        }
+
+        ++current;
+        for(int level = 1; level < LEVELS && !(current & ((1ull << (BITS * level)) - 1)); ++level) cascade(level);
+      }
+    }
+
+    // milliseconds until the next timer is due (at the latest), -1 if there is none
+    int64_t nextTimeout(uint64_t now) const {
+      if(!size) return -1;
+
+      for(uint64_t t = current; t < (current | (SLOTS - 1)) + 1; ++t) {
+        if(!slots[0][t & (SLOTS - 1)].empty()) return t > now? t - now: 0;
+      }
+
+      // the next cascade will bring due timers to level 0
+      uint64_t t = (current | (SLOTS - 1)) + 1;
+      return t > now? t - now: 0;
+    }
+
+  private:
+    static const int LEVELS = 4;
+    static const int BITS = 8;
+    static const uint64_t SLOTS = 1 << BITS;
+
+    struct Timer {
+      uint64_t when;
+      uint64_t id;
+    };
+
+    uint64_t current;
+    uint64_t size;
+    std::vector<Timer> slots[LEVELS][SLOTS];
+
+    void insert(const Timer &timer) {
+      uint64_t when = timer.when < current? current: timer.when;
+      uint64_t delta = when - current;
+
+      for(int level = 0; level < LEVELS; ++level) {
+        if(delta < (1ull << (BITS * (level + 1)))) {
+          slots[level][(when >> (BITS * level)) & (SLOTS - 1)].push_back(timer);
+          return;
+        }
+      }
+
+      // beyond the wheel, park it in the slot cascaded last
+      slots[LEVELS - 1][((current >> (BITS * (LEVELS - 1))) - 1) & (SLOTS - 1)].push_back(timer);
+    }
+
+    void cascade(int level) {
+      std::vector<Timer> timers;
+      timers.swap(slots[level][(current >> (BITS * level)) & (SLOTS - 1)]);
+
+      for(auto &timer: timers) insert(timer);
+    }
+};
+
+#endif
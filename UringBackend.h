@@ -0,0 +1,238 @@
+#ifndef URINGBACKEND_H
+#define URINGBACKEND_H
+
+#include "IoBackend.h"
+
+#include <vector>
+#include <stdexcept>
+#include <string>
+#include <cassert>
+#include <errno.h>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+// Completions straight from io_uring, spoken to via the raw system calls.
+// Connects, receives and sends are only queued and go to the kernel in one
+// batch with the next wait().
+class UringBackend: public IoBackend {
+  public:
+    UringBackend(size_t connections): sequence(0), unsubmitted(0) {
+      // a connect or a receive and a send per connection
+      unsigned entries = 64;
+      while(entries < 2 * connections && entries < 32768) entries *= 2;
+
+      io_uring_params params;
+      memset(&params, 0, sizeof(params));
+
+      handle = syscall(__NR_io_uring_setup, entries, &params);
+      if(handle < 0) throw std::runtime_error("io_uring_setup failed: " + std::string(strerror(errno)));
+      if(!(params.features & IORING_FEAT_EXT_ARG)) throw std::runtime_error("io_uring lacks IORING_FEAT_EXT_ARG");
+
+      sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+      cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+      sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+
+      sqRing = map(sqRingSize, IORING_OFF_SQ_RING);
+      cqRing = map(cqRingSize, IORING_OFF_CQ_RING);
+      sqes = static_cast<io_uring_sqe *>(map(sqesSize, IORING_OFF_SQES));
+
+      sqHead = ring<unsigned>(sqRing, params.sq_off.head);
+      sqTail = ring<unsigned>(sqRing, params.sq_off.tail);
+      sqMask = *ring<unsigned>(sqRing, params.sq_off.ring_mask);
+      sqEntries = params.sq_entries;
+      sqArray = ring<unsigned>(sqRing, params.sq_off.array);
+
+      cqHead = ring<unsigned>(cqRing, params.cq_off.head);
+      cqTail = ring<unsigned>(cqRing, params.cq_off.tail);
+      cqMask = *ring<unsigned>(cqRing, params.cq_off.ring_mask);
+      cqes = ring<io_uring_cqe>(cqRing, params.cq_off.cqes);
+    }
+
+    ~UringBackend() {
+      munmap(sqes, sqesSize);
+      munmap(cqRing, cqRingSize);
+      munmap(sqRing, sqRingSize);
+      ::close(handle);
+    }
+
+    uint64_t connect(uint64_t slot, const SocketAddress &addr) {
+      int fd = ::socket(addr.getFamily(), SOCK_STREAM | SOCK_NONBLOCK, 0);
+      if(fd < 0) {
+        uint64_t connection = makeConnection(++sequence, -1);
+        completed.push_back(IoCompletion { slot, connection, IO_CONNECT, -errno });
+        return connection;
+      }
+
+      if(sockets.size() <= static_cast<size_t>(fd)) sockets.resize(fd + 1);
+      Socket &s = sockets[fd];
+      s.connection = makeConnection(++sequence, fd);
+      s.pending = 0;
+      s.slot = slot;
+      s.addr = addr;
+
+      io_uring_sqe *sqe = prepare(IORING_OP_CONNECT, fd, s.connection, IO_CONNECT);
+      sqe->addr = reinterpret_cast<uint64_t>(s.addr.get());
+      sqe->off = s.addr.getLength();
+
+      return s.connection;
+    }
+
+    void receive(uint64_t connection, char *b, size_t n) {
+      io_uring_sqe *sqe = prepare(IORING_OP_RECV, connectionFd(connection), connection, IO_RECEIVE);
+      sqe->addr = reinterpret_cast<uint64_t>(b);
+      sqe->len = n;
+    }
+
+    void send(uint64_t connection, const char *b, size_t n) {
+      io_uring_sqe *sqe = prepare(IORING_OP_SEND, connectionFd(connection), connection, IO_SEND);
+      sqe->addr = reinterpret_cast<uint64_t>(b);
+      sqe->len = n;
+      sqe->msg_flags = MSG_NOSIGNAL;
+    }
+
+    void close(uint64_t connection) {
+      int fd = connectionFd(connection);
+      if(fd < 0) return;
+
+      // Operations not completed yet are cancelled in the same system call that
+      // submits them: sockets wait by polling, and cancelling a poll is done
+      // right away, so no buffer is touched afterwards. Without any, closing
+      // costs no call to io_uring at all.
+      Socket &s = sockets[fd];
+      for(unsigned operation = IO_CONNECT; operation <= IO_SEND; ++operation) {
+        if(!(s.pending & 1u << operation)) continue;
+
+        io_uring_sqe *sqe = prepare(IORING_OP_ASYNC_CANCEL, -1, s.connection, static_cast<IoOperation>(operation));
+        sqe->addr = userData(s.connection, static_cast<IoOperation>(operation));
+        sqe->user_data = CANCEL;
+      }
+      if(s.pending) submit(0, 0);
+
+      s.connection = 0;
+      s.pending = 0;
+      ::close(fd);
+    }
+
+    void wait(int timeout, std::vector<IoCompletion> &completions) {
+      size_t before = completions.size();
+
+      completions.insert(completions.end(), completed.begin(), completed.end());
+      completed.clear();
+
+      reap(completions);
+      submit(completions.size() != before? 0: 1, timeout);
+      reap(completions);
+    }
+
+  private:
+    // user data of cancellations, no connection has it
+    static const uint64_t CANCEL = ~0ull;
+
+    struct Socket {
+      uint64_t connection;
+      unsigned pending; // operations queued or running, one bit each
+      uint64_t slot;
+      SocketAddress addr;
+    };
+
+    int handle;
+    uint64_t sequence;
+
+    void *sqRing, *cqRing;
+    size_t sqRingSize, cqRingSize, sqesSize;
+    io_uring_sqe *sqes;
+    unsigned *sqHead, *sqTail, *sqArray, sqMask, sqEntries;
+    unsigned *cqHead, *cqTail, cqMask;
+    io_uring_cqe *cqes;
+    unsigned unsubmitted;
+
+    std::vector<Socket> sockets;
+    std::vector<IoCompletion> completed;
+
+    void *map(size_t size, uint64_t offset) {
+      void *p = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, handle, offset);
+      if(p == MAP_FAILED) throw std::runtime_error("io_uring mmap failed: " + std::string(strerror(errno)));
+      return p;
+    }
+
+    template<class T> static T *ring(void *base, unsigned offset) {
+      return reinterpret_cast<T *>(static_cast<char *>(base) + offset);
+    }
+
+    // the operation is encoded into the low bits of the connection, whose
+    // sequence of at most 30 bits (see makeConnection()) leaves room for it
+    static uint64_t userData(uint64_t connection, IoOperation operation) {
+      return connection << 2 | operation;
+    }
+
+    io_uring_sqe *prepare(uint8_t opcode, int fd, uint64_t connection, IoOperation operation) {
+      unsigned tail = *sqTail;
+      if(tail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) == sqEntries) {
+        submit(0, 0);
+        tail = *sqTail;
+      }
+
+      unsigned index = tail & sqMask;
+      io_uring_sqe *sqe = &sqes[index];
+      memset(sqe, 0, sizeof(*sqe));
+      sqe->opcode = opcode;
+      sqe->fd = fd;
+      sqe->user_data = userData(connection, operation);
+      if(fd >= 0) sockets[fd].pending |= 1u << operation;
+
+      sqArray[index] = index;
+      __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+      ++unsubmitted;
+
+      return sqe;
+    }
+
+    // hands all queued operations to the kernel, optionally waiting for a completion
+    void submit(unsigned wait, int timeout) {
+      if(!unsubmitted && (!wait || !timeout)) return;
+
+      __kernel_timespec ts { timeout / 1000, (timeout % 1000) * 1000000ll };
+      io_uring_getevents_arg arg;
+      memset(&arg, 0, sizeof(arg));
+      arg.sigmask_sz = _NSIG / 8;
+      arg.ts = timeout < 0? 0: reinterpret_cast<uint64_t>(&ts);
+
+      int n = syscall(__NR_io_uring_enter, handle, unsubmitted, wait && timeout? 1: 0,
+          IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+
+      if(n >= 0) {
+        unsubmitted -= n;
+      } else if(errno != ETIME && errno != EINTR && errno != EBUSY) {
+        throw std::runtime_error("io_uring_enter failed: " + std::string(strerror(errno)));
+      }
+    }
+
+    void reap(std::vector<IoCompletion> &completions) {
+      unsigned head = *cqHead;
+      unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+
+      for(; head != tail; ++head) {
+        const io_uring_cqe &cqe = cqes[head & cqMask];
+        if(cqe.user_data == CANCEL) continue;
+
+        uint64_t connection = cqe.user_data >> 2;
+        int fd = connectionFd(connection);
+
+        // completions of closed connections are dropped right here
+        if(sockets[fd].connection != connection) continue;
+
+        IoOperation operation = static_cast<IoOperation>(cqe.user_data & 3);
+        sockets[fd].pending &= ~(1u << operation);
+        completions.push_back(IoCompletion { sockets[fd].slot, connection, operation, cqe.res });
+      }
+
+      __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+    }
+};
+
+#endif
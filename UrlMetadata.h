@@ -0,0 +1,168 @@
+#ifndef URLMETADATA_H
+#define URLMETADATA_H
+
+#include "MappedFile.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <string>
+#include <mutex>
+#include <stdexcept>
+
+// What the last fetch of a URL told about it, for conditional requests.
+struct UrlMetadata {
+  std::string etag;
+  uint32_t lastModified; // seconds since the epoch, 0 if unknown
+  uint32_t fetched;
+  uint64_t contentHash;
+};
+
+// URL fingerprint -> UrlMetadata, as an open addressing hash table of 64 byte
+// slots in a memory-mapped file. ETags longer than a slot holds are not kept.
+// The table doubles (into a new file, renamed over the old one) when it is
+// three quarters full. Thread-safe.
+class UrlMetadataStore {
+  public:
+    static const size_t MAX_ETAG = 39;
+
+    explicit UrlMetadataStore(const std::string &filename): filename(filename), file(0) {
+      struct stat st;
+      open(stat(filename.c_str(), &st) == 0? st.st_size: (INITIAL_SLOTS + 1) * sizeof(Slot));
+    }
+
+    ~UrlMetadataStore() {
+      delete file;
+    }
+
+    // false if nothing is known about key
+    bool lookup(uint64_t key, UrlMetadata &m) {
+      std::lock_guard<std::mutex> lock(mutex);
+
+      Slot &s = find(key);
+      if(!s.key) return false;
+
+      m.etag.assign(s.etag, s.etagLength);
+      m.lastModified = s.lastModified;
+      m.fetched = s.fetched;
+      m.contentHash = s.contentHash;
+      return true;
+    }
+
+    void update(uint64_t key, const UrlMetadata &m) {
+      std::lock_guard<std::mutex> lock(mutex);
+
+      if((header->used + 1) * 4 > header->slots * 3) grow();
+
+      Slot &s = find(key);
+      if(!s.key) {
+        s.key = fingerprint(key);
+        ++header->used;
+      }
+
+      s.etagLength = m.etag.length() <= MAX_ETAG? m.etag.length(): 0;
+      memcpy(s.etag, m.etag.data(), s.etagLength);
+      s.lastModified = m.lastModified;
+      s.fetched = m.fetched;
+      s.contentHash = m.contentHash;
+    }
+
+    uint64_t size() {
+      std::lock_guard<std::mutex> lock(mutex);
+      return header->used;
+    }
+
+    void sync(bool wait = false) {
+      std::lock_guard<std::mutex> lock(mutex);
+      file->sync(wait);
+    }
+
+  private:
+    static const uint64_t INITIAL_SLOTS = 1 << 16;
+
+    // key 0 is an empty slot
+    struct Slot {
+      uint64_t key;
+      uint64_t contentHash;
+      uint32_t fetched;
+      uint32_t lastModified;
+      uint8_t etagLength;
+      char etag[MAX_ETAG];
+    };
+
+    // the first slot of the file
+    struct Header {
+      char magic[8];
+      uint64_t slots;
+      uint64_t used;
+    };
+
+    std::string filename;
+    std::mutex mutex;
+    MappedFile *file;
+    Header *header;
+    Slot *slots;
+
+    static uint64_t fingerprint(uint64_t key) {
+      return key? key: 1;
+    }
+
+    void open(uint64_t size) {
+      if(size % sizeof(Slot) || size < 2 * sizeof(Slot)) throw std::runtime_error("corrupt URL metadata: " + filename);
+
+      MappedFile *f = new MappedFile(filename, size);
+      header = reinterpret_cast<Header *>(f->getData());
+      slots = reinterpret_cast<Slot *>(f->getData()) + 1;
+
+      if(f->isFresh()) {
+        memcpy(header->magic, "CrUrlMd1", 8);
+        header->slots = size / sizeof(Slot) - 1;
+      } else if(memcmp(header->magic, "CrUrlMd1", 8) || header->slots != size / sizeof(Slot) - 1) {
+        delete f;
+        throw std::runtime_error("corrupt URL metadata: " + filename);
+      }
+
+      delete file;
+      file = f;
+    }
+
+    // the slot of key, or the empty one where it belongs
+    Slot &find(uint64_t key) {
+      key = fingerprint(key);
+
+      for(uint64_t i = key % header->slots; ; i = (i + 1) % header->slots) {
+        if(slots[i].key == key || !slots[i].key) return slots[i];
+      }
+    }
+
+    void grow() {
+      std::string grown = filename + ".grow";
+      unlink(grown.c_str());
+
+      uint64_t count = header->slots;
+      MappedFile *old = file;
+      Slot *oldSlots = slots;
+
+      file = 0;
+      std::swap(filename, grown);
+      open((2 * count + 1) * sizeof(Slot));
+      std::swap(filename, grown);
+
+      for(uint64_t i = 0; i < count; ++i) {
+        if(!oldSlots[i].key) continue;
+
+        find(oldSlots[i].key) = oldSlots[i];
+        ++header->used;
+      }
+
+      file->sync(true);
+      if(rename(grown.c_str(), filename.c_str()) < 0) throw std::runtime_error("could not replace " + filename + ": " + strerror(errno));
+
+      delete old;
+    }
+
+    UrlMetadataStore(const UrlMetadataStore &);
+};
+
+#endif
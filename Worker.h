@@ -0,0 +1,442 @@
+#ifndef WORKER_H
+#define WORKER_H
+
+#include "Domain.h"
+#include "EpollBackend.h"
+#include "UringBackend.h"
+#include "DnsCache.h"
+#include "AdaptiveLimit.h"
+
+#include <vector>
+#include <algorithm>
+#include <string>
+#include <sstream>
+#include <mutex>
+#include <functional>
+#include <unordered_map>
+#include <cassert>
+#include <adns.h>
+
+// Crawls one shard of the domains, with its own resolver and I/O backend.
+// Everything shared between workers (seen lines, ignore list, host frontier)
+// is thread-safe.
+class Worker {
+  public:
+    struct Report {
+      std::string screen;
+      Domain::ReportSum sum;
+      size_t domainsNew, domainsResolving, domainsDownloading;
+      uint64_t buffersUsed, buffersReserved;
+      uint64_t frontierSpilled;
+      uint64_t resolverLimit;
+    };
+
+    Worker(uint64_t activeDomains): activeDomains(activeDomains), checkpointSeconds(0), io(new EpollBackend()), output(0), spill(0), hostFrontier(0), busy(false), dnsCache(0), domainsResolving(0), metrics(0), reportDomains(true), finished(false) {
+      report.sum = Domain::ReportSum { 0 };
+      report.domainsNew = report.domainsResolving = report.domainsDownloading = 0;
+      report.buffersUsed = report.buffersReserved = 0;
+      report.frontierSpilled = 0;
+      report.resolverLimit = 0;
+    }
+
+    ~Worker() {
+      for(auto d: domains) d->setFrontierSpill(0);
+      for(auto d: discovered) {
+        d->finishDownloading();
+        delete d;
+      }
+
+      delete spill;
+      delete output;
+      delete io;
+    }
+
+    // takes ownership, must be set before domains are added
+    void setOutputLog(OutputLog *log) {
+      output = log;
+    }
+
+    // takes ownership, must be set before domains are added
+    void setFrontierSpill(FrontierSpill *s) {
+      spill = s;
+    }
+
+    // Idle workers start domains for the hosts queued here, made by factory(url).
+    // Without a frontier a worker ends with its own domains.
+    void setHostFrontier(HostFrontier *frontier, const std::function<Domain *(const std::string &)> &factory) {
+      hostFrontier = frontier;
+      domainFactory = factory;
+
+      // busy from the start, so no worker gives up before the others found anything
+      hostFrontier->setBusy(busy, true);
+    }
+
+    // resolved addresses are looked up here first and added here
+    void setDnsCache(DnsCache *cache) {
+      dnsCache = cache;
+    }
+
+    // resolver and event loop timings go here, and those of all domains added later
+    void setMetrics(Metrics &m) {
+      metrics = &m;
+      dnsSeconds = &m.histogram("crawler_dns_seconds", "Time to resolve a host name.");
+      loopSeconds = &m.histogram("crawler_loop_seconds", "Time spent in one event loop iteration, without waiting.");
+    }
+
+    // without, the report has no line per domain
+    void setReportDomains(bool enable) {
+      reportDomains = enable;
+    }
+
+    void addDomain(Domain *d) {
+      if(metrics) d->setMetrics(*metrics);
+      d->setOutputLog(output);
+      d->setFrontierSpill(spill);
+      d->setBufferPool(&buffers);
+      domains.push_back(d);
+      if(!d->isFinished()) domainsNew.push_back(d);
+    }
+
+    // "epoll" or "io_uring"
+    void setIoBackend(const std::string &name) {
+      IoBackend *backend;
+      if(name == "epoll") {
+        backend = new EpollBackend();
+      } else if(name == "io_uring") {
+        backend = new UringBackend(activeDomains);
+      } else {
+        throw std::runtime_error("Unknown I/O backend: " + name);
+      }
+
+      delete io;
+      io = backend;
+    }
+
+    // 0 disables checkpoints
+    void setCheckpointSeconds(uint64_t seconds) {
+      checkpointSeconds = seconds;
+    }
+
+    void run() {
+      adns_state adnsState;
+      adns_init(&adnsState, adns_initflags(), 0);
+
+      uint64_t now = monotonicMilliseconds();
+      uint64_t lastReport = 0;
+      uint64_t lastCheckpoint = now;
+      uint64_t downloadingCount = 0;
+
+      // outstanding queries, fewer if too many time out
+      AdaptiveLimit resolverLimit(128, 8, 1024);
+
+      // A and AAAA answers, reused across lookups
+      std::vector<SocketAddress> addresses;
+
+      // Every downloading domain has at most one live timer, at wakeups[slot].
+      // Timers are only moved to earlier times, a timer fired too early simply
+      // reschedules for the domain's real wakeup.
+      TimerWheel timers(now);
+      std::vector<uint64_t> wakeups;
+
+      auto schedule = [&](uint64_t slot) {
+        if(!domainsDownloading[slot]) return;
+
+        uint64_t when = std::max(domainsDownloading[slot]->getWakeup(), now + 1);
+        if(wakeups[slot] && wakeups[slot] <= when) return;
+
+        wakeups[slot] = when;
+        timers.schedule(when, slot);
+      };
+
+      // domains done in this iteration, released at its end
+      std::vector<Domain *> ended;
+      auto end = [&](uint64_t slot) {
+        ended.push_back(domainsDownloading[slot]);
+        domainsDownloading[slot] = 0;
+        --downloadingCount;
+      };
+
+      auto startDownloading = [&](Domain *d) {
+        auto zero = find(domainsDownloading.begin(), domainsDownloading.end(), nullptr);
+        if(zero == domainsDownloading.end()) {
+          domainsDownloading.push_back(d);
+          wakeups.push_back(0);
+          zero = domainsDownloading.end() - 1;
+        } else {
+          *zero = d;
+        }
+
+        uint64_t slot = zero - domainsDownloading.begin();
+        wakeups[slot] = 0;
+        ++downloadingCount;
+
+        d->startDownloading(*io, slot);
+        schedule(slot);
+      };
+
+      std::vector<IoCompletion> completions;
+
+      while(true) {
+        uint64_t iterationStarted = monotonicMicroseconds();
+
+        bool working = !domainsNew.empty() || domainsResolving || !domainsDownloading.empty();
+        if(hostFrontier) hostFrontier->setBusy(busy, working);
+        if(!working && (!hostFrontier || hostFrontier->isDone())) break;
+
+        if(hostFrontier && domainsNew.empty() && domainsResolving + downloadingCount < activeDomains) {
+          takeHosts(std::min<uint64_t>(128, activeDomains - domainsResolving - downloadingCount));
+        }
+
+        if(now >= lastReport + 1000) {
+          std::ostringstream screen;
+          Domain::ReportSum sum = { 0 };
+          for(size_t i = 0; i < domainsDownloading.size(); ++i) {
+            if(!domainsDownloading[i]) continue;
+
+            domainsDownloading[i]->report(reportDomains? &screen: 0, &sum);
+          }
+
+          std::lock_guard<std::mutex> lock(reportLock);
+          report.screen = screen.str();
+          report.sum = sum;
+          report.domainsNew = domainsNew.size();
+          report.domainsResolving = domainsResolving;
+          report.domainsDownloading = downloadingCount;
+          report.buffersUsed = buffers.getUsed();
+          report.buffersReserved = buffers.getReserved();
+          report.frontierSpilled = spill? spill->getSpilled(): 0;
+          report.resolverLimit = resolverLimit.get();
+
+          lastReport = now;
+        }
+
+        while(!domainsNew.empty() && domainsResolving + downloadingCount < activeDomains) {
+          Domain *d = domainsNew.back();
+
+          if(dnsCache && dnsCache->lookup(d->getDnsName(), addresses)) {
+            domainsNew.pop_back();
+            d->setAddresses(addresses);
+            startDownloading(d);
+            continue;
+          }
+
+          if(domainsResolving >= resolverLimit.get()) break;
+
+          // the domain itself is the query context, no lookup needed on the answer
+          adns_query query;
+          adns_submit(adnsState, d->getDnsName().c_str(), adns_r_addr, adns_qf_want_allaf, d, &query);
+          if(metrics) resolveStarted[d] = monotonicMicroseconds();
+
+          ++domainsResolving;
+          domainsNew.pop_back();
+        }
+
+        while(1) {
+          Domain *resolved;
+          adns_query query = 0;
+          adns_answer *answer = 0;
+
+          adns_check(adnsState, &query, &answer, reinterpret_cast<void **>(&resolved));
+
+          if(!answer) break;
+
+          --domainsResolving;
+          resolverLimit.record(answer->status == adns_s_timeout);
+
+          if(metrics) {
+            auto started = resolveStarted.find(resolved);
+            dnsSeconds->record(monotonicMicroseconds() - started->second);
+            resolveStarted.erase(started);
+          }
+
+          addresses.clear();
+          if(answer->status == adns_s_ok) {
+            for(int i = 0; i < answer->nrrs; ++i) {
+              SocketAddress a;
+              if(a.assign(&answer->rrs.addr[i].addr.sa)) addresses.push_back(a);
+            }
+          }
+
+          if(addresses.empty()) {
+            std::cout << "Domain resolution failed (" << answer->status << ") for: " << resolved->getHostname() << std::endl;
+            ended.push_back(resolved);
+          } else {
+            resolved->setAddresses(addresses);
+            if(dnsCache) dnsCache->insert(resolved->getDnsName(), addresses, answer->expires);
+
+            // std::cout << "Domain resolved: " << resolved->getHostname() << " -> " << resolved->getAddressString() << std::endl;
+
+            startDownloading(resolved);
+          }
+
+          free(answer);
+        }
+
+        // sleep until the next timer, but keep polling the resolver and reporting
+        int64_t timeout = 1000 - static_cast<int64_t>(now - lastReport);
+        int64_t next = timers.nextTimeout(now);
+        if(next >= 0 && next < timeout) timeout = next;
+        if((domainsResolving || !working) && timeout > 100) timeout = 100;
+
+        uint64_t waitStarted = monotonicMicroseconds();
+        io->wait(std::max<int64_t>(timeout, 0), completions);
+        now = monotonicMilliseconds();
+        uint64_t waitEnded = monotonicMicroseconds();
+
+        for(auto &completion: completions) {
+          // the domain may have finished on an earlier completion of this batch
+          Domain *domain = completion.slot < domainsDownloading.size()? domainsDownloading[completion.slot]: 0;
+          if(!domain) continue;
+
+          uint64_t slot = completion.slot;
+          domain->handleCompletion(*io, completion, [&] { end(slot); });
+          schedule(slot);
+        }
+        completions.clear();
+
+        timers.expire(now, [&](uint64_t slot, uint64_t when) {
+          if(slot >= domainsDownloading.size() || wakeups[slot] != when) return; // superseded
+          wakeups[slot] = 0;
+
+          Domain *domain = domainsDownloading[slot];
+          if(!domain) return;
+
+          domain->handleLoop(*io, [&] { end(slot); });
+          schedule(slot);
+        });
+
+        for(auto d: ended) release(d);
+        ended.clear();
+
+        while(!domainsDownloading.empty() && !domainsDownloading.back()) domainsDownloading.pop_back();
+        wakeups.resize(domainsDownloading.size());
+
+        if(checkpointSeconds && now - lastCheckpoint >= checkpointSeconds * 1000) {
+          takeCheckpoint();
+          lastCheckpoint = now;
+        }
+
+        if(metrics) loopSeconds->record(waitStarted - iterationStarted + monotonicMicroseconds() - waitEnded);
+      }
+
+      if(checkpointSeconds) takeCheckpoint();
+
+      adns_finish(adnsState);
+
+      std::lock_guard<std::mutex> lock(reportLock);
+      report.screen.clear();
+      report.sum = Domain::ReportSum { 0 };
+      report.domainsNew = report.domainsResolving = report.domainsDownloading = 0;
+      report.buffersUsed = report.buffersReserved = 0;
+      report.frontierSpilled = 0;
+      report.resolverLimit = 0;
+      finished = true;
+    }
+
+    // snapshot the state of all domains of this worker
+    void takeCheckpoint() {
+      // pages finished so far are in the output, the ones in progress are fetched again on resume
+      if(output) output->flush();
+
+      std::ostringstream out;
+      for(auto d: domains) {
+        out << "domain " << d->getHostname() << '\n';
+        d->saveState(out);
+      }
+
+      std::lock_guard<std::mutex> lock(checkpointLock);
+      checkpoint = out.str();
+    }
+
+    // Starts domains for up to n hosts of the frontier. Their state is added to
+    // the last checkpoint right away, the frontier will not list them again.
+    void takeHosts(size_t n) {
+      n -= hostFrontier->takeSeeds(n, [&](const std::vector<std::string> &urls) {
+        Domain *d;
+        try {
+          d = domainFactory(urls[0]);
+        } catch(std::runtime_error &e) {
+          std::cerr << "Invalid seed: " << e.what() << std::endl;
+          return;
+        }
+
+        for(size_t i = 1; i < urls.size(); ++i) d->fetch(urls[i]);
+        adopt(d);
+      });
+
+      hostFrontier->take(n, [&](const std::string &url) { adopt(domainFactory(url)); });
+    }
+
+    std::string getCheckpoint() {
+      std::lock_guard<std::mutex> lock(checkpointLock);
+      return checkpoint;
+    }
+
+    Report getReport() {
+      std::lock_guard<std::mutex> lock(reportLock);
+      return report;
+    }
+
+    bool isFinished() {
+      std::lock_guard<std::mutex> lock(reportLock);
+      return finished;
+    }
+
+  private:
+    void adopt(Domain *d) {
+      discovered.push_back(d);
+      addDomain(d);
+
+      std::ostringstream out;
+      out << "domain " << d->getHostname() << '\n';
+      d->saveState(out);
+
+      std::lock_guard<std::mutex> lock(checkpointLock);
+      checkpoint += out.str();
+    }
+
+    // Domains from the frontier are deleted once done, so memory only grows
+    // with the active ones. The host frontier remembers them. Domains added
+    // from outside stay with their owner.
+    void release(Domain *d) {
+      auto i = std::find(discovered.begin(), discovered.end(), d);
+      if(i == discovered.end()) return;
+
+      discovered.erase(i);
+      domains.erase(std::find(domains.begin(), domains.end(), d));
+      delete d;
+    }
+
+    std::vector<Domain *> domains, domainsNew, domainsDownloading;
+    uint64_t activeDomains;
+    uint64_t checkpointSeconds;
+    IoBackend *io;
+    OutputLog *output;
+    BufferPool buffers;
+    FrontierSpill *spill;
+
+    // domains for hosts taken from the frontier, owned by the worker
+    HostFrontier *hostFrontier;
+    std::function<Domain *(const std::string &)> domainFactory;
+    std::vector<Domain *> discovered;
+    bool busy;
+
+    DnsCache *dnsCache;
+    uint64_t domainsResolving;
+
+    Metrics *metrics;
+    Histogram *dnsSeconds, *loopSeconds;
+    std::unordered_map<Domain *, uint64_t> resolveStarted;
+    bool reportDomains;
+
+    std::mutex reportLock;
+    Report report;
+    bool finished;
+
+    std::mutex checkpointLock;
+    std::string checkpoint;
+
+    Worker(const Worker &);
+};
+
+#endif
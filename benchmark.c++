@@ -0,0 +1,526 @@
+#include "Hash.h"
+#include "TimerWheel.h"
+
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <deque>
+#include <unordered_map>
+#include <thread>
+#include <atomic>
+#include <stdexcept>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <zlib.h>
+
+// End-to-end benchmark: serves synthetic sites from a local HTTP server,
+// crawls them with a crawler binary and reports its throughput and resource
+// usage. No network access is needed, the hosts h0.bench, h1.bench, ... are
+// put into the DNS cache as 127.1.0.1, 127.1.0.2, ... (all loopback).
+
+struct Options {
+  std::string crawler;
+  uint64_t hosts;
+  uint64_t pages;          // fetched per host
+  uint64_t pageBytes;
+  uint64_t fanout;         // links per page
+  uint64_t duplicates;     // percentage of lines also found on other pages
+  uint64_t latency;        // milliseconds before each response
+  uint64_t robotsRules;
+  uint64_t serverThreads;
+  uint64_t threads;        // of the crawler
+  uint64_t pipelineDepth;
+  uint64_t gzip;           // compress pages for clients accepting it
+
+  Options(): crawler("./crawler-release"), hosts(8), pages(500), pageBytes(16384), fanout(8), duplicates(50),
+    latency(0), robotsRules(16), serverThreads(2), threads(1), pipelineDepth(1), gzip(0) { }
+};
+
+static std::string compress(const std::string &data);
+
+// The pages of all hosts, generated from the host name and page number.
+// Page n links to pages n * fanout + 1 to n * fanout + fanout, so a site is
+// an endless tree. Duplicate lines come from a pool shared by all pages.
+class SyntheticSite {
+  public:
+    SyntheticSite(const Options &options): options(options) { }
+
+    // false for a path not on the site
+    bool page(const std::string &host, const std::string &path, std::string &body) const {
+      body.clear();
+
+      if(path == "/robots.txt") {
+        body += "User-agent: *\n";
+        for(uint64_t i = 0; i < options.robotsRules; ++i) {
+          // every fourth rule a wildcard, none of them matching real pages
+          if(i % 4 == 3) {
+            body += "Disallow: /*.tmp" + std::to_string(i) + "$\n";
+          } else {
+            body += "Disallow: /private/" + std::to_string(i) + "/\n";
+          }
+        }
+        return true;
+      }
+
+      uint64_t n = 0;
+      if(path != "/") {
+        if(path.compare(0, 2, "/p") || path.length() < 8 || path.compare(path.length() - 5, 5, ".html")) return false;
+
+        char *end;
+        n = strtoull(path.c_str() + 2, &end, 10);
+        if(end != path.c_str() + path.length() - 5) return false;
+      }
+
+      uint64_t seed = hashFinish(hashBytes(host.data(), host.length()), n);
+
+      body += "<html><head><title>" + host + " page " + std::to_string(n) + "</title></head><body>\n";
+      for(uint64_t i = 1; i <= options.fanout; ++i) {
+        body += "<a href=\"/p" + std::to_string(n * options.fanout + i) + ".html\">next " + std::to_string(i) + "</a>\n";
+      }
+
+      char line[128];
+      for(uint64_t i = 0; body.length() < options.pageBytes; ++i) {
+        uint64_t r = hashFinish(seed, i);
+
+        if(r % 100 < options.duplicates) {
+          snprintf(line, sizeof(line), "<p>Shared paragraph %llu, as seen on many other pages of the web.</p>\n",
+              static_cast<unsigned long long>((r >> 8) % POOL_LINES));
+        } else {
+          snprintf(line, sizeof(line), "<p>Paragraph %016llx %016llx of a page no one else has.</p>\n",
+              static_cast<unsigned long long>(r), static_cast<unsigned long long>(hashFinish(r, i)));
+        }
+
+        body += line;
+      }
+
+      body += "</body></html>\n";
+      return true;
+    }
+
+  private:
+    static const uint64_t POOL_LINES = 1024;
+
+    const Options &options;
+};
+
+// Keep-alive HTTP/1.1 server on port 80 (the crawler knows no other),
+// answering pipelined requests in order. Every thread waits on the listening
+// socket, and serves the connections it accepted.
+class SyntheticServer {
+  public:
+    SyntheticServer(const Options &options): options(options), site(options), stopping(false), pages(0), bytes(0), nextId(0) {
+      for(uint64_t i = 0; i < options.hosts; ++i) {
+        int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+        if(fd < 0) throw std::runtime_error("socket failed: " + std::string(strerror(errno)));
+        listenFds.push_back(fd);
+
+        int one = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+        sockaddr_in addr { AF_INET, htons(PORT), { hostAddress(i) } };
+        if(bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0 || listen(fd, 1024) < 0) {
+          throw std::runtime_error("could not listen on port 80: " + std::string(strerror(errno)));
+        }
+      }
+    }
+
+    ~SyntheticServer() {
+      stop();
+      for(auto fd: listenFds) close(fd);
+    }
+
+    // address of host i, in network byte order
+    static uint32_t hostAddress(uint64_t i) {
+      return htonl(0x7f010001 + i);
+    }
+
+    void start() {
+      for(uint64_t i = 0; i < std::max<uint64_t>(1, options.serverThreads); ++i) threads.push_back(std::thread([this] { serve(); }));
+    }
+
+    void stop() {
+      stopping = true;
+      for(auto &t: threads) t.join();
+      threads.clear();
+    }
+
+    // pages served, without robots.txt
+    uint64_t getPages() const {
+      return pages;
+    }
+
+    // bytes sent, headers included
+    uint64_t getBytes() const {
+      return bytes;
+    }
+
+  private:
+    static const uint16_t PORT = 80;
+
+    struct Connection {
+      uint64_t id;
+      std::string in, out;
+      size_t sent;
+      bool writing;
+    };
+
+    // a response held back for the latency
+    struct Delayed {
+      uint64_t due;
+      int fd;
+      uint64_t id;
+      std::string response;
+    };
+
+    const Options &options;
+    SyntheticSite site;
+    std::vector<int> listenFds;
+    std::vector<std::thread> threads;
+    std::atomic<bool> stopping;
+    std::atomic<uint64_t> pages, bytes;
+    std::atomic<uint64_t> nextId;
+
+    void serve() {
+      int epollFd = epoll_create1(0);
+      std::unordered_map<int, Connection> connections;
+
+      // listening sockets carry no connection
+      for(auto fd: listenFds) {
+        epoll_event event { EPOLLIN | EPOLLEXCLUSIVE, { 0 } };
+        event.data.fd = fd;
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event);
+      }
+
+      std::deque<Delayed> delayed; // in order of due, the latency is the same for all
+      std::string body;
+      epoll_event events[64];
+
+      auto closeConnection = [&](int fd) {
+        epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, 0);
+        close(fd);
+        connections.erase(fd);
+      };
+
+      // false if the connection was closed
+      auto flush = [&](int fd, Connection &c) {
+        while(c.sent < c.out.length()) {
+          ssize_t n = write(fd, c.out.data() + c.sent, c.out.length() - c.sent);
+          if(n < 0 && errno == EAGAIN) break;
+          if(n <= 0) {
+            closeConnection(fd);
+            return false;
+          }
+
+          c.sent += n;
+        }
+
+        if(c.sent == c.out.length()) {
+          c.out.clear();
+          c.sent = 0;
+        }
+
+        bool writing = !c.out.empty();
+        if(writing != c.writing) {
+          epoll_event event { static_cast<uint32_t>(writing? EPOLLIN | EPOLLOUT: EPOLLIN), { 0 } };
+          event.data.fd = fd;
+          epoll_ctl(epollFd, EPOLL_CTL_MOD, fd, &event);
+          c.writing = writing;
+        }
+
+        return true;
+      };
+
+      while(!stopping) {
+        int timeout = 100;
+        if(!delayed.empty()) timeout = std::max<int64_t>(0, std::min<int64_t>(timeout, delayed.front().due - monotonicMilliseconds()));
+
+        int n = epoll_wait(epollFd, events, 64, timeout);
+        for(int i = 0; i < n; ++i) {
+          int fd = events[i].data.fd;
+
+          auto found = connections.find(fd);
+          if(found == connections.end()) {
+            int client;
+            while((client = accept4(fd, 0, 0, SOCK_NONBLOCK)) >= 0) {
+              connections[client] = Connection { nextId++, "", "", 0, false };
+
+              epoll_event event { EPOLLIN, { 0 } };
+              event.data.fd = client;
+              epoll_ctl(epollFd, EPOLL_CTL_ADD, client, &event);
+            }
+            continue;
+          }
+
+          Connection &c = found->second;
+
+          if(events[i].events & EPOLLOUT && !flush(fd, c)) continue;
+          if(!(events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))) continue;
+
+          char buffer[16384];
+          ssize_t length = read(fd, buffer, sizeof(buffer));
+          if(length < 0 && errno == EAGAIN) continue;
+          if(length <= 0) {
+            closeConnection(fd);
+            continue;
+          }
+
+          c.in.append(buffer, length);
+
+          size_t end;
+          while((end = c.in.find("\r\n\r\n")) != std::string::npos) {
+            std::string response = respond(c.in.substr(0, end), body);
+            c.in.erase(0, end + 4);
+
+            if(options.latency) {
+              delayed.push_back(Delayed { monotonicMilliseconds() + options.latency, fd, c.id, response });
+            } else {
+              c.out += response;
+            }
+          }
+
+          if(!flush(fd, c)) continue;
+        }
+
+        uint64_t now = monotonicMilliseconds();
+        while(!delayed.empty() && delayed.front().due <= now) {
+          Delayed &d = delayed.front();
+
+          auto found = connections.find(d.fd);
+          if(found != connections.end() && found->second.id == d.id) {
+            found->second.out += d.response;
+            flush(d.fd, found->second);
+          }
+
+          delayed.pop_front();
+        }
+      }
+
+      for(auto &c: connections) close(c.first);
+      close(epollFd);
+    }
+
+    std::string respond(const std::string &request, std::string &body) {
+      std::string path, host;
+      bool acceptsGzip = false;
+
+      std::istringstream lines(request);
+      std::string line;
+      getline(lines, line);
+      size_t space = line.find(' ');
+      if(space != std::string::npos) path = line.substr(space + 1, line.find(' ', space + 1) - space - 1);
+
+      while(getline(lines, line)) {
+        if(!line.compare(0, 6, "Host: ")) host = line.substr(6, line.find('\r') - 6);
+        if(!line.compare(0, 17, "Accept-Encoding: ") && line.find("gzip") != std::string::npos) acceptsGzip = true;
+      }
+
+      std::string status = "200 OK";
+      if(!site.page(host, path, body)) {
+        status = "404 Not Found";
+        body = "not found\n";
+      } else if(path != "/robots.txt") {
+        ++pages;
+      }
+
+      std::string encoding;
+      if(options.gzip && acceptsGzip) {
+        body = compress(body);
+        encoding = "Content-Encoding: gzip\r\n";
+      }
+
+      std::string response = "HTTP/1.1 " + status + "\r\nContent-Type: text/html\r\n" + encoding + "Content-Length: " +
+        std::to_string(body.length()) + "\r\n\r\n" + body;
+      bytes += response.length();
+      return response;
+    }
+};
+
+static std::string compress(const std::string &data) {
+  z_stream stream;
+  memset(&stream, 0, sizeof(stream));
+  deflateInit2(&stream, 6, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY);
+
+  std::string out(deflateBound(&stream, data.length()), 0);
+  stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data.data()));
+  stream.avail_in = data.length();
+  stream.next_out = reinterpret_cast<Bytef *>(&out[0]);
+  stream.avail_out = out.length();
+  deflate(&stream, Z_FINISH);
+
+  out.resize(stream.total_out);
+  deflateEnd(&stream);
+  return out;
+}
+
+static double wallSeconds() {
+  timeval t;
+  gettimeofday(&t, 0);
+  return t.tv_sec + t.tv_usec / 1e6;
+}
+
+static int removeFile(const char *path, const struct stat *, int, struct FTW *) {
+  return remove(path);
+}
+
+static void usage() {
+  Options defaults;
+  std::cerr << "usage: ./benchmark [key=value ...]\n"
+    "  crawler=" << defaults.crawler << "\n"
+    "  hosts=" << defaults.hosts << "\n"
+    "  pages=" << defaults.pages << " (per host)\n"
+    "  pageBytes=" << defaults.pageBytes << "\n"
+    "  fanout=" << defaults.fanout << " (links per page)\n"
+    "  duplicates=" << defaults.duplicates << " (percentage of lines shared between pages)\n"
+    "  latency=" << defaults.latency << " (milliseconds)\n"
+    "  robotsRules=" << defaults.robotsRules << "\n"
+    "  serverThreads=" << defaults.serverThreads << "\n"
+    "  threads=" << defaults.threads << " (of the crawler)\n"
+    "  pipelineDepth=" << defaults.pipelineDepth << "\n"
+    "  gzip=" << defaults.gzip << " (1 compresses pages)" << std::endl;
+}
+
+int main(int argc, char *argv[]) {
+  Options options;
+
+  for(int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    size_t equals = arg.find('=');
+    if(equals == std::string::npos) {
+      usage();
+      return 1;
+    }
+
+    std::string key = arg.substr(0, equals);
+    std::string value = arg.substr(equals + 1);
+    uint64_t number = strtoull(value.c_str(), 0, 10);
+
+    if(key == "crawler") {
+      options.crawler = value;
+    } else if(key == "hosts") {
+      options.hosts = number;
+    } else if(key == "pages") {
+      options.pages = number;
+    } else if(key == "pageBytes") {
+      options.pageBytes = number;
+    } else if(key == "fanout") {
+      options.fanout = number;
+    } else if(key == "duplicates") {
+      options.duplicates = number;
+    } else if(key == "latency") {
+      options.latency = number;
+    } else if(key == "robotsRules") {
+      options.robotsRules = number;
+    } else if(key == "serverThreads") {
+      options.serverThreads = number;
+    } else if(key == "threads") {
+      options.threads = number;
+    } else if(key == "pipelineDepth") {
+      options.pipelineDepth = number;
+    } else if(key == "gzip") {
+      options.gzip = number;
+    } else {
+      usage();
+      return 1;
+    }
+  }
+
+  if(options.hosts < 1 || options.hosts > 0xfffffe) {
+    std::cerr << "hosts out of range" << std::endl;
+    return 1;
+  }
+
+  char directory[] = "/tmp/crawler-bench.XXXXXX";
+  if(!mkdtemp(directory)) {
+    std::cerr << "could not create a directory: " << strerror(errno) << std::endl;
+    return 1;
+  }
+  std::string dir = directory;
+  mkdir((dir + "/data").c_str(), 0755);
+
+  {
+    std::ofstream dns((dir + "/dns.cache").c_str());
+    for(uint64_t i = 0; i < options.hosts; ++i) {
+      dns << "h" << i << ".bench " << SyntheticServer::hostAddress(i) << ' ' << time(0) + 86400 << '\n';
+    }
+
+    std::ofstream config((dir + "/config").c_str());
+    config <<
+      "expectedLines " << options.hosts * options.pages * (options.pageBytes / 64 + 1) << "\n"
+      "cooldownMilliseconds 0\n"
+      "fetchesPerDomain " << options.pages << "\n"
+      "activeDomains " << std::max<uint64_t>(options.hosts, 16) << "\n"
+      "threads " << options.threads << "\n"
+      "pipelineDepth " << options.pipelineDepth << "\n"
+      "outputPath " << dir << "/data\n"
+      "dnsCacheFile " << dir << "/dns.cache\n"
+      "console none\n";
+    for(uint64_t i = 0; i < options.hosts; ++i) config << "fetch http://h" << i << ".bench/\n";
+  }
+
+  int status;
+  rusage usage;
+  double seconds;
+  uint64_t pages, bytes;
+
+  try {
+    SyntheticServer server(options);
+    server.start();
+
+    double start = wallSeconds();
+
+    pid_t pid = fork();
+    if(pid < 0) throw std::runtime_error("fork failed: " + std::string(strerror(errno)));
+
+    if(!pid) {
+      int log = open((dir + "/crawler.log").c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+      dup2(log, 1);
+      dup2(log, 2);
+      execl(options.crawler.c_str(), options.crawler.c_str(), (dir + "/config").c_str(), static_cast<char *>(0));
+      perror("exec failed");
+      _exit(127);
+    }
+
+    if(wait4(pid, &status, 0, &usage) < 0) throw std::runtime_error("wait failed: " + std::string(strerror(errno)));
+    seconds = wallSeconds() - start;
+
+    server.stop();
+    pages = server.getPages();
+    bytes = server.getBytes();
+  } catch(std::exception &e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+
+  if(!WIFEXITED(status) || WEXITSTATUS(status)) {
+    std::cerr << "crawler failed, see " << dir << "/crawler.log" << std::endl;
+    return 1;
+  }
+
+  double cpu = usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+
+  std::cout << std::fixed << std::setprecision(1) <<
+    "pages:           " << pages << " in " << seconds << " s\n" <<
+    "pages/s:         " << pages / seconds << "\n" <<
+    "MB/s:            " << bytes / seconds / 1e6 << "\n" <<
+    "CPU seconds/GB:  " << cpu / (bytes / 1e9) << "\n" <<
+    "peak RSS:        " << usage.ru_maxrss / 1024.0 << " MB" << std::endl;
+
+  nftw(dir.c_str(), removeFile, 16, FTW_DEPTH | FTW_PHYS);
+  return 0;
+}
@@ -1,4 +1,5 @@
 #include "Domain.h"
+#include "Worker.h"
 
 #include <vector>
 #include <algorithm>
@@ -6,12 +7,16 @@
 #include <fstream>
 #include <iostream>
 #include <map>
+#include <thread>
 #include <cassert>
-#include <adns.h>
-#include <sys/epoll.h>
+#include <cstdio>
+#include <sys/wait.h>
+
+// first port of local shards without shardPeer lines
+static const int DEFAULT_SHARD_PORT = 7700;
 
 int main(int argc, char *argv[]) {
-  std::vector<Domain *> domains, domainsNew, domainsResolving, domainsDownloading;
+  std::vector<Domain *> domains;
 
   if(argc != 2) {
     std::cerr << "usage: ./crawler <config>" << std::endl;
@@ -21,13 +26,67 @@ int main(int argc, char *argv[]) {
   PostfixSet ignoreList;
   uint64_t expectedLines = 100000;
   uint64_t activeDomains = 1024;
+  std::string seenLinesFile;
+  std::string checkpointFile;
+  std::string dnsCacheFile;
+  std::string metricsFile;
+  std::string urlMetadataFile;
+  std::string seedFile;
+  std::string console = "summary";
+  uint64_t checkpointSeconds = 60;
+  uint64_t threads = 1;
+  std::string ioBackend = "epoll";
+  std::string outputPath = "data";
+  uint64_t outputSegmentMegabytes = 1024;
+  uint64_t frontierMemoryMegabytes = 256;
+  uint64_t maxHosts = 1000000;
+  uint64_t cooldownMilliseconds = 5000;
+  uint64_t connectTimeoutMilliseconds = 5000;
+  uint64_t adaptivePoliteness = 0;
+  uint64_t minCooldownMilliseconds = 250;
+  uint64_t maxCooldownMilliseconds = 60000;
+  uint64_t fetchesPerDomain = 1000;
+  uint64_t recursionMode = 1;
+  uint64_t pipelineDepth = 1;
+  uint64_t nearDuplicateBits = 0;
+  uint64_t nearDuplicatePages = 1000000;
+  uint64_t recrawl = 0;
+  uint64_t processes = 1;
+  uint64_t shard = 0;
+  std::vector<std::string> shardPeers;
+  uint64_t forwardLines = 0;
+
+  auto newDomain = [&](const std::string &url) {
+    Domain *d = new Domain(url);
+    d->setRemainingFetches(fetchesPerDomain);
+    d->setCooldownMilliseconds(cooldownMilliseconds);
+    d->setConnectTimeoutMilliseconds(connectTimeoutMilliseconds);
+    d->setRecursionMode(recursionMode);
+    d->setPipelineDepth(pipelineDepth);
+    if(adaptivePoliteness) d->setAdaptivePoliteness(minCooldownMilliseconds, maxCooldownMilliseconds);
+    return d;
+  };
+
+  // set up after the config is read, for a sharded crawl
+  Shards *shards = 0;
+
+  // hosts queued in the checkpoint, but not yet taken by a worker
+  std::vector<std::string> discoveredUrls;
+
+  // known hosts and seed file position of the checkpoint
+  BlockedBloomSet *knownHosts = 0;
+  uint64_t knownHostCount = 0;
+  uint64_t seedOffset = 0;
 
   {
     std::map<std::string, Domain *> hostUnifier;
-    uint64_t cooldownMilliseconds = 5000;
-    uint64_t fetchesPerDomain = 1000;
-    uint64_t recursionMode = 1;
-    std::string outputPath = "data";
+
+    auto domainFor = [&](const std::string &url) {
+      Domain *&d = hostUnifier[Domain::extractHost(url)];
+      if(!d) domains.push_back(d = newDomain(url));
+
+      return d;
+    };
 
     std::ifstream config(argv[1]);
 
@@ -40,16 +99,68 @@ int main(int argc, char *argv[]) {
         config >> expectedLines; config.get();
       } else if(configKeyword == "cooldownMilliseconds") {
         config >> cooldownMilliseconds; config.get();
+      } else if(configKeyword == "adaptivePoliteness") {
+        config >> adaptivePoliteness; config.get();
+      } else if(configKeyword == "minCooldownMilliseconds") {
+        config >> minCooldownMilliseconds; config.get();
+      } else if(configKeyword == "maxCooldownMilliseconds") {
+        config >> maxCooldownMilliseconds; config.get();
+      } else if(configKeyword == "connectTimeoutMilliseconds") {
+        config >> connectTimeoutMilliseconds; config.get();
       } else if(configKeyword == "fetchesPerDomain") {
         config >> fetchesPerDomain; config.get();
       } else if(configKeyword == "activeDomains") {
         config >> activeDomains; config.get();
+      } else if(configKeyword == "threads") {
+        config >> threads; config.get();
       } else if(configKeyword == "recursionMode") {
         config >> recursionMode; config.get();
+      } else if(configKeyword == "pipelineDepth") {
+        config >> pipelineDepth; config.get();
+      } else if(configKeyword == "nearDuplicateBits") {
+        config >> nearDuplicateBits; config.get();
+      } else if(configKeyword == "nearDuplicatePages") {
+        config >> nearDuplicatePages; config.get();
+      } else if(configKeyword == "ioBackend") {
+        getline(config, ioBackend);
       } else if(configKeyword == "outputPath") {
         std::string path;
         getline(config, path);
         outputPath = path;
+      } else if(configKeyword == "outputSegmentMegabytes") {
+        config >> outputSegmentMegabytes; config.get();
+      } else if(configKeyword == "frontierMemoryMegabytes") {
+        config >> frontierMemoryMegabytes; config.get();
+      } else if(configKeyword == "maxHosts") {
+        config >> maxHosts; config.get();
+      } else if(configKeyword == "seenLinesFile") {
+        getline(config, seenLinesFile);
+      } else if(configKeyword == "checkpointFile") {
+        getline(config, checkpointFile);
+      } else if(configKeyword == "dnsCacheFile") {
+        getline(config, dnsCacheFile);
+      } else if(configKeyword == "metricsFile") {
+        getline(config, metricsFile);
+      } else if(configKeyword == "seedFile") {
+        getline(config, seedFile);
+      } else if(configKeyword == "urlMetadataFile") {
+        getline(config, urlMetadataFile);
+      } else if(configKeyword == "recrawl") {
+        config >> recrawl; config.get();
+      } else if(configKeyword == "processes") {
+        config >> processes; config.get();
+      } else if(configKeyword == "shard") {
+        config >> shard; config.get();
+      } else if(configKeyword == "shardPeer") {
+        std::string peer;
+        getline(config, peer);
+        shardPeers.push_back(peer);
+      } else if(configKeyword == "forwardLines") {
+        config >> forwardLines; config.get();
+      } else if(configKeyword == "console") {
+        getline(config, console);
+      } else if(configKeyword == "checkpointSeconds") {
+        config >> checkpointSeconds; config.get();
       } else if(configKeyword == "ignore") {
         std::string extension;
         getline(config, extension);
@@ -58,182 +169,387 @@ int main(int argc, char *argv[]) {
         std::string domain;
         getline(config, domain);
 
-        Domain *&d = hostUnifier[Domain::extractHost(domain)];
-        if(!d) {
-          domains.push_back(d = new Domain(domain));
-          d->setRemainingFetches(fetchesPerDomain);
-          d->setCooldownMilliseconds(cooldownMilliseconds);
-          d->setRecursionMode(recursionMode);
-          d->setOutputPath(outputPath);
-        }
-
-        d->fetch(domain);
+        domainFor(domain)->fetch(domain);
       } else {
         std::cerr << "Unknow config keyword: " << configKeyword << std::endl;
         return 1;
       }
     }
-  }
 
-  BloomSet seenLines(expectedLines);
+    if(console != "domains" && console != "summary" && console != "none") {
+      std::cerr << "Unknown console mode: " << console << std::endl;
+      return 1;
+    }
 
-  for(auto d: domains) {
-    d->setSeenLines(&seenLines);
-    d->setIgnoreList(&ignoreList);
-    domainsNew.push_back(d);
-  }
+    if(recrawl && urlMetadataFile.empty()) {
+      std::cerr << "recrawl needs a urlMetadataFile" << std::endl;
+      return 1;
+    }
 
-  adns_state adnsState;
-  adns_init(&adnsState, adns_initflags(), 0);
+    if(processes > 1 && seenLinesFile.empty()) {
+      std::cerr << "processes need a seenLinesFile to share" << std::endl;
+      return 1;
+    }
 
-  int epollHandle = epoll_create(activeDomains);
+    // local shards, on consecutive ports unless configured
+    if(processes > 1 && shardPeers.empty()) {
+      for(uint64_t i = 0; i < processes; ++i) shardPeers.push_back("127.0.0.1:" + std::to_string(DEFAULT_SHARD_PORT + i));
+    }
 
-  while(!domainsNew.empty() || !domainsResolving.empty() || !domainsDownloading.empty()) {
-    int downloadingCount = 0;
-    for(auto d: domainsDownloading) downloadingCount += !!d;
+    // the parent only waits for its processes, shards shard .. shard + processes - 1
+    if(processes > 1) {
+      uint64_t children = 0;
+      for(; children < processes; ++children) {
+        pid_t pid = fork();
+        if(pid < 0) {
+          std::cerr << "Could not fork: " << strerror(errno) << std::endl;
+          return 1;
+        }
 
-    std::cout << "\e[1;1H\e[2J";
+        if(!pid) {
+          shard += children;
+          if(children) console = "none";
+          break;
+        }
+      }
 
-    Domain::ReportSum sum = { 0 };
-    for(size_t i = 0; i < domainsDownloading.size(); ++i) {
-      if(!domainsDownloading[i]) continue;
+      if(children == processes) {
+        int failed = 0, status;
+        while(wait(&status) > 0) failed |= !WIFEXITED(status) || WEXITSTATUS(status);
+        return failed;
+      }
+    }
 
-      domainsDownloading[i]->report(&sum);
+    if(shardPeers.size() > 1) {
+      shards = new Shards(shard, shardPeers);
+
+      // files of each shard, only the seen lines are shared
+      std::string suffix = "." + std::to_string(shard);
+      if(!checkpointFile.empty()) checkpointFile += suffix;
+      if(!dnsCacheFile.empty()) dnsCacheFile += suffix;
+      if(!metricsFile.empty()) metricsFile += suffix;
+      if(!urlMetadataFile.empty()) urlMetadataFile += suffix;
+
+      // seeds of other shards are left to them
+      for(auto i = domains.begin(); i != domains.end();) {
+        if(shards->owns((*i)->getHostname())) {
+          ++i;
+          continue;
+        }
+
+        hostUnifier.erase((*i)->getHostname());
+        delete *i;
+        i = domains.erase(i);
+      }
     }
-    std::cout << "[" <<
-      std::setw(10) << sum.reportDownloaded << " b/s | " <<
-      std::setw(10) << sum.reportDownloadedNew << " b/s ], " <<
-      std::setw(8) << sum.remainingFetches << " | " <<
-      std::setw(8) << sum.searchFrontSize << " -- Totals"
-      << std::endl;
 
-    int bloomFill = seenLines.estimateFill();
+    if(!checkpointFile.empty()) {
+      std::ifstream checkpoint(checkpointFile.c_str(), std::ios::binary);
 
-    std::cout <<
-      "Entering loop. New: " << domainsNew.size() <<
-      ", Resolving: " << domainsResolving.size() <<
-      ", Downloading: " << downloadingCount <<
-      ", Bloomfilter fill (0 - 1000): " << bloomFill<<
-      std::endl;
+      std::string checkpointKeyword;
+      while(checkpoint.good()) {
+        getline(checkpoint, checkpointKeyword, ' ');
+        if(checkpointKeyword == "") break;
 
-    if(bloomFill > 750) {
-      std::cerr << "Bloom filter is full." << std::endl;
-      break;
-    }
+        if(checkpointKeyword == "discovered") {
+          std::string url;
+          getline(checkpoint, url);
+          discoveredUrls.push_back(url);
+          continue;
+        }
 
-    for(int i = 0; i < 10; ++i) {
-      while(!domainsNew.empty() &&
-          domainsResolving.size() + downloadingCount < activeDomains && !domainsNew.empty() &&
-          domainsResolving.size() < 128) { // empirical testing says too many outstanding queries just timeout
-        adns_query query;
+        if(checkpointKeyword == "hosts") {
+          checkpoint >> knownHostCount; checkpoint.get();
+          delete knownHosts;
+          knownHosts = BlockedBloomSet::load(checkpoint);
+          continue;
+        }
 
-        adns_submit(adnsState,
-            domainsNew.back()->getHostname().c_str(), 
-            adns_r_a, adns_queryflags(), domainsNew.back(), &query);
+        if(checkpointKeyword == "seeds") {
+          checkpoint >> seedOffset; checkpoint.get();
+          continue;
+        }
+
+        if(checkpointKeyword != "domain") {
+          std::cerr << "Corrupt checkpoint: " << checkpointFile << std::endl;
+          return 1;
+        }
+
+        std::string hostname;
+        getline(checkpoint, hostname);
 
-        domainsResolving.push_back(domainsNew.back());
-        domainsNew.pop_back();
+        domainFor("http://" + hostname + "/")->loadState(checkpoint);
       }
+    }
+  }
 
-      while(1) {
-        Domain *resolved;
-        adns_query query = 0;
-        adns_answer *answer = 0;
+  ScalableBloomSet *seenLines = seenLinesFile.empty()?
+    new ScalableBloomSet(expectedLines):
+    new ScalableBloomSet(expectedLines, seenLinesFile);
 
-        adns_check(adnsState, &query, &answer, reinterpret_cast<void **>(&resolved));
+  UrlMetadataStore *urlMetadata = urlMetadataFile.empty()? 0: new UrlMetadataStore(urlMetadataFile);
 
-        if(!answer) break;
+  HostFrontier hostFrontier(maxHosts);
+  if(knownHosts) {
+    hostFrontier.restore(knownHosts, knownHostCount);
+    for(auto &url: discoveredUrls) hostFrontier.requeue(url);
+  } else {
+    for(auto &url: discoveredUrls) hostFrontier.discover(Domain::extractHost(url), Domain::extractPath(url));
+  }
+  for(auto d: domains) hostFrontier.add(d->getHostname());
 
-        auto pos = std::find(domainsResolving.begin(), domainsResolving.end(), resolved);
+  SeedFile *seeds = seedFile.empty()? 0: new SeedFile(seedFile, seedOffset, fetchesPerDomain);
+  if(seeds && shards) seeds->setFilter([shards](const std::string &host) { return shards->owns(host); });
+  hostFrontier.setSeeds(seeds);
+  if(shards) hostFrontier.setRouter([shards](const std::string &host, const std::string &path) { return shards->forwardHost(host, path); });
 
-        if(answer->status != adns_s_ok) {
-          std::cout << "Domain resolution failed (" << answer->status << ") for: " << resolved->getHostname() << std::endl;
-        } else {
-          (*pos)->setIp(answer->rrs.inaddr->s_addr);
+  DnsCache dnsCache;
+  if(!dnsCacheFile.empty()) {
+    std::ifstream in(dnsCacheFile.c_str());
+    dnsCache.load(in);
+  }
 
-          // std::cout << "Domain resolved: " << resolved->getHostname() << " -> " << resolved->getIpString() << std::endl;
+  IpCooldown ipCooldown;
+
+  Metrics metrics;
+  Gauge &bloomLines = metrics.gauge("crawler_bloom_lines", "Lines in the seen lines filter.");
+  Gauge &bloomFill = metrics.gauge("crawler_bloom_fill", "Fraction of bits set in the current seen lines filter layer.");
+  Gauge &hostsQueued = metrics.gauge("crawler_hosts_queued", "Discovered hosts waiting for a worker.");
+  Gauge &hostsKnown = metrics.gauge("crawler_hosts_known", "Hosts known to the host frontier.");
+  Gauge &frontierPaths = metrics.gauge("crawler_frontier_paths", "Paths in the search fronts of downloading domains.");
+  Gauge &frontierBytes = metrics.gauge("crawler_frontier_bytes", "Memory of the search fronts of downloading domains.");
+  Gauge &frontierSpilledBytes = metrics.gauge("crawler_frontier_spilled_bytes", "Search front data spilled to disk.");
+  Gauge &domainsNewGauge = metrics.gauge("crawler_domains_new", "Domains waiting to be resolved.");
+  Gauge &domainsResolvingGauge = metrics.gauge("crawler_domains_resolving", "Domains being resolved.");
+  Gauge &domainsDownloadingGauge = metrics.gauge("crawler_domains_downloading", "Domains downloading.");
+  Gauge &dnsCached = metrics.gauge("crawler_dns_cached", "Host names in the DNS cache.");
+  Histogram &fetchSeconds = metrics.histogram("crawler_fetch_seconds", "Time from the request to the end of its response.");
+  Counter &compressedBytes = metrics.counter("crawler_compressed_bytes_total", "Compressed body bytes received.");
+  Counter &inflatedBytes = metrics.counter("crawler_inflated_bytes_total", "Bytes of text decompressed from them.");
+  Histogram &firstByteSeconds = metrics.histogram("crawler_first_byte_seconds", "Time from the request to the first byte of its response.");
+  Counter &unchangedPages = metrics.counter("crawler_unchanged_pages_total", "Recrawled pages not modified since the last fetch.");
+
+  // 0 bits (the default) disables near-duplicate detection
+  SimHashIndex *pageIndex = nearDuplicateBits? new SimHashIndex(nearDuplicatePages, nearDuplicateBits): 0;
+
+  // domains for hosts found while crawling, created by the workers
+  auto discoveredDomain = [&](const std::string &url) {
+    Domain *d = newDomain(url);
+    d->fetch(url);
+    d->setSeenLines(seenLines);
+    d->setIgnoreList(&ignoreList);
+    d->setHostFrontier(&hostFrontier);
+    d->setIpCooldown(&ipCooldown);
+    d->setNearDuplicateIndex(pageIndex);
+    d->setUrlMetadata(urlMetadata, recrawl);
+    if(forwardLines) d->setLineForwarding(shards);
+    return d;
+  };
+
+  if(threads < 1) threads = 1;
+
+  std::vector<Worker *> workers;
+  for(uint64_t i = 0; i < threads; ++i) {
+    workers.push_back(new Worker(std::max<uint64_t>(1, activeDomains / threads)));
+    workers.back()->setIoBackend(ioBackend);
+    workers.back()->setMetrics(metrics);
+    workers.back()->setReportDomains(console == "domains");
+    workers.back()->setOutputLog(new OutputLog(outputPath + "/crawl-" + std::to_string(shard * threads + i), outputSegmentMegabytes * 1024 * 1024));
+    workers.back()->setFrontierSpill(new FrontierSpill(outputPath, frontierMemoryMegabytes * 1024 * 1024 / threads));
+    workers.back()->setHostFrontier(&hostFrontier, discoveredDomain);
+    workers.back()->setDnsCache(&dnsCache);
+    if(!checkpointFile.empty()) workers.back()->setCheckpointSeconds(checkpointSeconds);
+  }
 
-          auto zero = find(domainsDownloading.begin(), domainsDownloading.end(), nullptr);
-          if(zero == domainsDownloading.end()) {
-            domainsDownloading.push_back(*pos);
-            zero = domainsDownloading.end() - 1;
-          } else {
-            *zero = *pos;
-          }
+  for(auto d: domains) {
+    d->setSeenLines(seenLines);
+    d->setIgnoreList(&ignoreList);
+    d->setHostFrontier(&hostFrontier);
+    d->setIpCooldown(&ipCooldown);
+    d->setNearDuplicateIndex(pageIndex);
+    d->setUrlMetadata(urlMetadata, recrawl);
+    if(forwardLines) d->setLineForwarding(shards);
+
+    Worker *w = workers[hashBytes(d->getHostname().c_str(), d->getHostname().length()) % threads];
+    w->addDomain(d);
+  }
 
-          (*pos)->startDownloading([&](int fd, bool in, bool out) {
-            epoll_event ev { static_cast<uint32_t>(in * EPOLLIN | out * EPOLLOUT),
-              { .u64 = static_cast<uint64_t>(zero - domainsDownloading.begin()) }};
-            epoll_ctl(epollHandle, EPOLL_CTL_ADD, fd, &ev);
-          });
-        }
+  for(auto w: workers) w->takeCheckpoint();
 
-        assert(pos != domainsResolving.end());
+  if(shards) {
+    shards->setMetrics(metrics);
+    shards->start(&hostFrontier, seenLines);
+  }
 
-        *pos = domainsResolving.back();
-        domainsResolving.pop_back();
-      }
+  uint64_t lastCheckpoint = monotonicMilliseconds();
 
-      timeval end;
-      gettimeofday(&end, 0);
-      end.tv_usec += 100000;
+  auto writeCheckpoint = [&] {
+    if(checkpointFile.empty()) return;
 
-      if(end.tv_usec >= 1000000) {
-        end.tv_usec -= 1000000;
-        end.tv_sec += 1;
-      }
+    std::ofstream out((checkpointFile + ".tmp").c_str(), std::ios::binary | std::ios::trunc);
 
-      while(1) {
-        epoll_event epollEvent;
-
-        timeval now;
-        gettimeofday(&now, 0);
-        int msRemaining = ((end.tv_sec - now.tv_sec) * 1000000 + end.tv_usec - now.tv_usec) / 1000;
-        if(msRemaining < 0) break;
-        if(epoll_wait(epollHandle, &epollEvent, 1, msRemaining) <= 0) break;
-
-        assert(epollEvent.data.u64 < domainsDownloading.size());
-
-        Domain *domain = domainsDownloading[epollEvent.data.u64];
-        
-        auto finish = [&] { domainsDownloading[epollEvent.data.u64] = 0; };
-        auto _ = [&](int action) {
-          return [&, action](int fd, bool in, bool out) {
-            epoll_event ev { static_cast<uint32_t>(in * EPOLLIN | out * EPOLLOUT), { .u64 = epollEvent.data.u64 }};
-            epoll_ctl(epollHandle, action, fd, &ev);
-          };
-        };
-
-        if(epollEvent.events & EPOLLIN) domain->handleInput(_(EPOLL_CTL_ADD), _(EPOLL_CTL_MOD), _(EPOLL_CTL_DEL), finish);
-        if(epollEvent.events & EPOLLOUT) domain->handleOutput(_(EPOLL_CTL_ADD), _(EPOLL_CTL_MOD), _(EPOLL_CTL_DEL), finish);
-        if(epollEvent.events & (EPOLLERR | EPOLLHUP)) domain->handleError(_(EPOLL_CTL_ADD), _(EPOLL_CTL_MOD), _(EPOLL_CTL_DEL), finish);
-      }
+    // frontier first: a host taken in between is already in its worker's checkpoint
+    out << "hosts ";
+    hostFrontier.save(out);
+    out << "seeds " << hostFrontier.getSeedOffset() << '\n';
+    for(auto &url: hostFrontier.getQueue()) out << "discovered " << url << '\n';
+    for(auto w: workers) out << w->getCheckpoint();
+    out.close();
+
+    if(!out) {
+      std::cerr << "Could not write checkpoint: " << checkpointFile << std::endl;
+      return;
+    }
+
+    seenLines->sync(true);
+    if(urlMetadata) urlMetadata->sync(true);
+    if(rename((checkpointFile + ".tmp").c_str(), checkpointFile.c_str()) < 0) {
+      std::cerr << "Could not write checkpoint: " << checkpointFile << ": " << strerror(errno) << std::endl;
     }
+  };
 
-    while(!domainsDownloading.empty() && !domainsDownloading.back()) domainsDownloading.pop_back();
+  auto writeMetrics = [&] {
+    if(metricsFile.empty()) return;
+
+    bloomLines.set(seenLines->getElements());
+    bloomFill.set(seenLines->getFill() / 1000.0);
+    hostsQueued.set(hostFrontier.size());
+    hostsKnown.set(hostFrontier.getHosts());
+    dnsCached.set(dnsCache.size());
+
+    std::ofstream out((metricsFile + ".tmp").c_str(), std::ios::trunc);
+    metrics.write(out);
+    out.close();
+
+    if(!out || rename((metricsFile + ".tmp").c_str(), metricsFile.c_str()) < 0) {
+      std::cerr << "Could not write metrics: " << metricsFile << std::endl;
+    }
+  };
 
-    for(size_t i = 0; i < domainsDownloading.size(); ++i) {
-      if(!domainsDownloading[i]) continue;
+  auto writeDnsCache = [&] {
+    if(dnsCacheFile.empty()) return;
 
-      auto finish = [&] { domainsDownloading[i] = 0; };
-      auto _ = [&](int action) {
-        return [&, action](int fd, bool in, bool out) {
-          epoll_event ev { static_cast<uint32_t>(in * EPOLLIN | out * EPOLLOUT), { .u64 = i }};
-          epoll_ctl(epollHandle, action, fd, &ev);
-        };
-      };
+    std::ofstream out((dnsCacheFile + ".tmp").c_str(), std::ios::trunc);
+    dnsCache.save(out);
+    out.close();
 
-      domainsDownloading[i]->handleLoop(_(EPOLL_CTL_ADD), _(EPOLL_CTL_MOD), _(EPOLL_CTL_DEL), finish);
+    if(!out || rename((dnsCacheFile + ".tmp").c_str(), dnsCacheFile.c_str()) < 0) {
+      std::cerr << "Could not write DNS cache: " << dnsCacheFile << std::endl;
+    }
+  };
+
+  std::vector<std::thread> workerThreads;
+  for(auto w: workers) workerThreads.push_back(std::thread([w] { w->run(); }));
+
+  while(1) {
+    bool running = false;
+    for(int i = 0; i < 10; ++i) {
+      running = false;
+      for(auto w: workers) running |= !w->isFinished();
+      if(!running) break;
+
+      usleep(100000);
+    }
+    if(!running) break;
+
+    Domain::ReportSum sum = { 0 };
+    size_t domainsNew = 0, domainsResolving = 0, domainsDownloading = 0;
+    uint64_t resolverLimit = 0;
+    uint64_t buffersUsed = 0, buffersReserved = 0, frontierSpilled = 0;
+    std::string screen;
+    for(auto w: workers) {
+      Worker::Report report = w->getReport();
+
+      screen += report.screen;
+      sum.reportDownloaded += report.sum.reportDownloaded;
+      sum.reportDownloadedNew += report.sum.reportDownloadedNew;
+      sum.remainingFetches += report.sum.remainingFetches;
+      sum.searchFrontSize += report.sum.searchFrontSize;
+      sum.searchFrontMemory += report.sum.searchFrontMemory;
+      domainsNew += report.domainsNew;
+      domainsResolving += report.domainsResolving;
+      resolverLimit += report.resolverLimit;
+      domainsDownloading += report.domainsDownloading;
+      buffersUsed += report.buffersUsed;
+      buffersReserved += report.buffersReserved;
+      frontierSpilled += report.frontierSpilled;
+    }
+
+    frontierPaths.set(sum.searchFrontSize);
+    frontierBytes.set(sum.searchFrontMemory);
+    frontierSpilledBytes.set(frontierSpilled);
+    domainsNewGauge.set(domainsNew);
+    domainsResolvingGauge.set(domainsResolving);
+    domainsDownloadingGauge.set(domainsDownloading);
+    writeMetrics();
+
+    if(console != "none") {
+      std::cout << "\e[1;1H\e[2J" << screen;
+
+      std::cout << "[" <<
+        std::setw(10) << sum.reportDownloaded << " b/s | " <<
+        std::setw(10) << sum.reportDownloadedNew << " b/s ], " <<
+        std::setw(8) << sum.remainingFetches << " | " <<
+        std::setw(8) << sum.searchFrontSize << " | " <<
+        std::setw(6) << sum.searchFrontMemory / 1024 << " kB -- Totals"
+        << std::endl;
+
+      std::cout <<
+        "Threads: " << threads <<
+        ", New: " << domainsNew <<
+        ", Resolving: " << domainsResolving << " / " << resolverLimit <<
+        " (" << dnsCache.size() << " cached)" <<
+        ", Downloading: " << domainsDownloading <<
+        ", Buffers: " << buffersUsed / 1024 << " / " << buffersReserved / 1024 << " kB" <<
+        ", Frontier spilled: " << frontierSpilled / 1024 << " kB" <<
+        ", Hosts: " << hostFrontier.size() << " queued / " << hostFrontier.getHosts() << " known" <<
+        ", Seeds: " << hostFrontier.getSeedOffset() / 1024 << " / " << (seeds? seeds->getSize() / 1024: 0) << " kB read" <<
+        ", Near duplicates: " << (pageIndex? pageIndex->getDuplicates(): 0) <<
+        ", Bloomfilter lines: " << seenLines->getElements() <<
+        " / " << seenLines->getCapacity() <<
+        " in " << seenLines->getLayers() <<
+        " layers, " << seenLines->getMemory() / 1024 / 1024 << " MB" <<
+        ", fill (0 - 1000): " << seenLines->getFill() <<
+        std::endl;
+
+      std::cout <<
+        "First byte: " << firstByteSeconds.quantile(0.5) / 1000.0 << " / " << firstByteSeconds.quantile(0.99) / 1000.0 << " ms" <<
+        ", Fetch: " << fetchSeconds.quantile(0.5) / 1000.0 << " / " << fetchSeconds.quantile(0.99) / 1000.0 << " ms" <<
+        " (median / 99%)" <<
+        ", Compression: " << (compressedBytes.get()? 1.0 * inflatedBytes.get() / compressedBytes.get(): 0) <<
+        ", Unchanged: " << unchangedPages.get() << " / " << (urlMetadata? urlMetadata->size(): 0) << " URLs known" <<
+        std::endl;
+    }
+
+    seenLines->sync();
+    seenLines->refresh();
+    if(urlMetadata) urlMetadata->sync();
+
+    if(monotonicMilliseconds() - lastCheckpoint >= checkpointSeconds * 1000) {
+      writeCheckpoint();
+      writeDnsCache();
+      lastCheckpoint = monotonicMilliseconds();
     }
   }
 
-  close(epollHandle);
-  adns_finish(adnsState);
+  for(auto &t: workerThreads) t.join();
+
+  writeCheckpoint();
+  writeDnsCache();
+  writeMetrics();
+
+  delete shards;
+  for(auto w: workers) delete w;
 
   for(auto d: domains) {
     d->finishDownloading();
     delete d;
   }
 
+  delete seeds;
+  delete pageIndex;
+  delete seenLines;
+  delete urlMetadata;
+
   return 0;
 }
@@ -0,0 +1,193 @@
+#include "BloomSet.h"
+#include "BlockedBloomSet.h"
+#include "ScalableBloomSet.h"
+#include "LineScanner.h"
+#include "RobotsRules.h"
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <sys/time.h>
+
+// Keys resembling downloaded lines.
+static std::vector<std::string> makeKeys(uint64_t n, uint64_t offset) {
+  std::vector<std::string> keys;
+  keys.reserve(n);
+
+  char line[128];
+  for(uint64_t i = offset; i < offset + n; ++i) {
+    snprintf(line, sizeof(line), "  <li><a href=\"/archive/%llu.html\">Entry number %llu</a></li>\n",
+        static_cast<unsigned long long>(i * 7919 % 1000003), static_cast<unsigned long long>(i));
+    keys.push_back(line);
+  }
+
+  return keys;
+}
+
+static double now() {
+  timeval t;
+  gettimeofday(&t, 0);
+  return t.tv_sec + t.tv_usec / 1e6;
+}
+
+template<class S> void benchSet(const char *name, uint64_t expected) {
+  S set(expected);
+  std::vector<std::string> absent = makeKeys(expected / 4, 1ull << 40);
+
+  uint64_t inserted = 0;
+  for(int level = 25; level <= 150; level += 25) {
+    std::vector<std::string> keys = makeKeys(expected * level / 100 - inserted, inserted);
+
+    double start = now();
+    for(auto &k: keys) set.insert(k);
+    double insertTime = now() - start;
+    inserted += keys.size();
+
+    uint64_t falsePositives = 0;
+    start = now();
+    for(auto &k: absent) falsePositives += set.contains(k);
+    double containsTime = now() - start;
+
+    std::cout << std::setw(16) << name <<
+      " | fill " << std::setw(3) << level << "%" <<
+      " | insert " << std::setw(7) << std::fixed << std::setprecision(1) << insertTime * 1e9 / keys.size() << " ns" <<
+      " | contains " << std::setw(7) << containsTime * 1e9 / absent.size() << " ns" <<
+      " | false positives " << std::setw(9) << std::setprecision(6) << 1.0 * falsePositives / absent.size() <<
+      std::endl;
+  }
+}
+
+// the line splitting of Domain::handleInput before LineScanner
+template<class F> static const char *scanScalar(const char *b, const char *e, const F &f) {
+  for(const char *s = b; s != e; ++s) {
+    if(s < e - 4) {
+      uint32_t v = *reinterpret_cast<const uint32_t *>(s);
+      if((v & 0xff000000ul) != 0xa000000ul &&
+         (v & 0x00ff0000ul) != 0x00a0000ul &&
+         (v & 0x0000ff00ul) != 0x0000a00ul &&
+         (v & 0x000000fful) != 0x000000aul) {
+        s += 3; continue;
+      }
+    }
+
+    if(*s == '\n') {
+      f(b, s + 1);
+      b = s + 1;
+    }
+  }
+
+  return b;
+}
+
+// parse plus dedup of <expected> lines, of which only <distinct> are different
+static void benchParse(uint64_t expected, uint64_t distinct) {
+  std::string page;
+  std::vector<std::string> lines = makeKeys(distinct, 0);
+  for(uint64_t i = 0; i < expected; ++i) page += lines[i * 7919 % distinct];
+
+  const size_t chunk = 16384;
+
+  {
+    ScalableBloomSet seen(expected);
+    uint64_t fresh = 0;
+
+    double start = now();
+    const char *rest = page.c_str();
+    for(size_t fill = 0; fill < page.length(); ) {
+      fill = std::min(page.length(), fill + chunk);
+      rest = scanScalar(rest, page.c_str() + fill, [&](const char *b, const char *e) { fresh += !seen.insert(b, e - b); });
+    }
+    double time = now() - start;
+
+    std::cout << std::setw(16) << "scalar + rehash" << " | " << std::setw(8) << distinct << " distinct | " << std::setw(8) << std::fixed << std::setprecision(1) <<
+      page.length() / time / 1e6 << " MB/s | " << fresh << " new lines" << std::endl;
+  }
+
+  {
+    ScalableBloomSet seen(expected);
+    LineScanner scanner;
+    uint64_t fresh = 0;
+
+    double start = now();
+    const char *rest = page.c_str();
+    for(size_t fill = 0; fill < page.length(); ) {
+      fill = std::min(page.length(), fill + chunk);
+      rest = scanner.scan(rest, page.c_str() + fill, [&](const char *, const char *, uint64_t hash) { fresh += !seen.insert(hash); });
+    }
+    double time = now() - start;
+
+    std::cout << std::setw(16) << "LineScanner" << " | " << std::setw(8) << distinct << " distinct | " << std::setw(8) << std::fixed << std::setprecision(1) <<
+      page.length() / time / 1e6 << " MB/s | " << fresh << " new lines" << std::endl;
+  }
+}
+
+// robots.txt with <rules> Disallow rules, matched against crawled paths, next
+// to the linear prefix scan Domain::handleUrl did before RobotsRules
+static void benchRobots(uint64_t rules, uint64_t paths) {
+  std::vector<std::string> patterns;
+  char line[128];
+  for(uint64_t i = 0; i < rules; ++i) {
+    snprintf(line, sizeof(line), "/archive/%llu/private/", static_cast<unsigned long long>(i * 7919 % 1000003));
+    patterns.push_back(line);
+  }
+
+  std::vector<std::string> urls;
+  for(uint64_t i = 0; i < paths; ++i) {
+    snprintf(line, sizeof(line), "/archive/%llu/page-%llu.html", static_cast<unsigned long long>(i * 104729 % 1000003),
+        static_cast<unsigned long long>(i));
+    urls.push_back(i % 10? std::string(line): patterns[i % rules] + (line + 9));
+  }
+
+  {
+    uint64_t disallowed = 0;
+    double start = now();
+    for(auto &u: urls) {
+      for(auto &p: patterns) {
+        if(!u.compare(0, p.length(), p)) {
+          ++disallowed;
+          break;
+        }
+      }
+    }
+    double time = now() - start;
+
+    std::cout << std::setw(16) << "prefix scan" << " | " << std::setw(8) << rules << " rules | " << std::setw(10) << std::fixed << std::setprecision(1) <<
+      time * 1e9 / paths << " ns/path | " << disallowed << " disallowed" << std::endl;
+  }
+
+  for(int wildcards = 0; wildcards < 2; ++wildcards) {
+    RobotsRules robots;
+    for(auto &p: patterns) robots.insert(p, false);
+    if(wildcards) {
+      robots.insert("/*.pdf$", false);
+      robots.insert("/archive/*/print", false);
+      robots.insert("/*?sessionid=", false);
+    }
+
+    uint64_t disallowed = 0;
+    double start = now();
+    for(auto &u: urls) disallowed += robots.disallows(u);
+    double time = now() - start;
+
+    std::cout << std::setw(16) << (wildcards? "RobotsRules + *": "RobotsRules") << " | " << std::setw(8) << robots.size() << " rules | " <<
+      std::setw(10) << std::fixed << std::setprecision(1) << time * 1e9 / paths << " ns/path | " << disallowed << " disallowed" << std::endl;
+  }
+}
+
+int main(int argc, char *argv[]) {
+  uint64_t expected = argc > 1? atoll(argv[1]): 4000000;
+
+  benchSet<BloomSet>("BloomSet", expected);
+  benchSet<BlockedBloomSet>("BlockedBloomSet", expected);
+  benchSet<ScalableBloomSet>("ScalableBloomSet", expected);
+
+  benchParse(expected, expected);
+  benchParse(expected, expected / 100);
+
+  benchRobots(100, 100000);
+  benchRobots(10000, 100000);
+
+  return 0;
+}
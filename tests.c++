@@ -1,8 +1,34 @@
 #include "BloomSet.h"
-#include "PrefixSet.h"
+#include "BlockedBloomSet.h"
+#include "ScalableBloomSet.h"
+#include "LineScanner.h"
+#include "HttpResponse.h"
+#include "TimerWheel.h"
+#include "OutputLog.h"
+#include "BufferPool.h"
+#include "PathFrontier.h"
+#include "HostFrontier.h"
+#include "SeedFile.h"
+#include "SocketAddress.h"
+#include "DnsCache.h"
+#include "AdaptiveLimit.h"
+#include "IpCooldown.h"
+#include "HostPace.h"
+#include "SimHash.h"
+#include "RobotsRules.h"
 #include "PostfixSet.h"
+#include "LinkScanner.h"
+#include "Metrics.h"
+#include "Inflater.h"
+#include "UrlMetadata.h"
+#include "Shards.h"
 
 #include <cassert>
+#include <cstdio>
+#include <sstream>
+#include <fstream>
+#include <vector>
+#include <algorithm>
 
 int main(void) {
   BloomSet set(1024);
@@ -17,17 +43,730 @@ int main(void) {
   assert(set.contains("abce", 4));
   assert(!set.contains("abcf", 4));
 
-  PrefixSet prefix;
+  std::stringstream saved;
+  set.save(saved);
+  BloomSet *loaded = BloomSet::load(saved);
+  assert(loaded->contains("abce", 4));
+  assert(!loaded->contains("abcd", 4));
+  delete loaded;
 
-  prefix.insert("/log/");
-  prefix.insert("/blog");
+  unlink("tests.bloom");
+  {
+    BloomSet mapped(1024, "tests.bloom");
+    assert(!mapped.contains("abce", 4));
+    mapped.insert("abce", 4);
+  }
+  {
+    BloomSet mapped(1024, "tests.bloom");
+    assert(mapped.contains("abce", 4));
+    assert(!mapped.contains("abcd", 4));
+  }
+  unlink("tests.bloom");
 
-  assert(prefix.matches("/log/abcdef"));
-  assert(!prefix.matches("/logabcdef"));
-  assert(!prefix.matches("logabcdef"));
-  assert(!prefix.matches("/blorg"));
-  assert(prefix.matches("/blog/what"));
-  assert(prefix.matches("/blogwhat"));
+  BlockedBloomSet blocked(1024);
+
+  assert(!blocked.contains("abcd", 4));
+  assert(!blocked.insert("abce", 4));
+  assert(blocked.insert("abce", 4));
+  assert(blocked.contains(std::string("abce")));
+  assert(!blocked.contains("abcd", 4));
+  assert(!blocked.contains("abcf", 4));
+
+  std::stringstream blockedSaved;
+  blocked.save(blockedSaved);
+  BlockedBloomSet *blockedLoaded = BlockedBloomSet::load(blockedSaved);
+  assert(blockedLoaded->contains("abce", 4));
+  assert(!blockedLoaded->contains("abcd", 4));
+  delete blockedLoaded;
+
+  ScalableBloomSet scalable(16);
+  for(int i = 0; i < 1000; ++i) scalable.insert(std::to_string(i));
+  for(int i = 0; i < 1000; ++i) assert(scalable.contains(std::to_string(i)));
+  assert(!scalable.contains("abcd", 4));
+  assert(scalable.getLayers() == 6);
+  assert(scalable.getElements() > 990 && scalable.getElements() <= 1000);
+  assert(scalable.getCapacity() == 16 * 63);
+
+  unlink("tests.bloom.0");
+  unlink("tests.bloom.1");
+  {
+    ScalableBloomSet mapped(16, "tests.bloom");
+    for(int i = 0; i < 20; ++i) mapped.insert(std::to_string(i));
+    assert(mapped.getLayers() == 2);
+  }
+  {
+    ScalableBloomSet mapped(16, "tests.bloom");
+    assert(mapped.getLayers() == 2);
+    assert(mapped.getElements() == 20);
+    for(int i = 0; i < 20; ++i) assert(mapped.contains(std::to_string(i)));
+
+    // another process sharing the files adds a layer
+    ScalableBloomSet other(16, "tests.bloom");
+    for(int i = 20; i < 60; ++i) other.insert(std::to_string(i));
+    assert(other.getLayers() == 3);
+    assert(!mapped.contains("59") && mapped.getLayers() == 2);
+    mapped.refresh();
+    assert(mapped.contains("59") && mapped.getLayers() == 3);
+  }
+  unlink("tests.bloom.0");
+  unlink("tests.bloom.1");
+  unlink("tests.bloom.2");
+
+  std::string text;
+  for(int i = 0; i < 300; ++i) text += std::string(i % 97, 'a' + i % 26) + "\n";
+  text += "incomplete";
+
+  for(size_t chunk = 1; chunk < 200; chunk += 13) {
+    LineScanner scanner;
+    int lines = 0;
+
+    const char *rest = text.c_str();
+    for(size_t fill = 0; fill < text.length(); ) {
+      fill = std::min(text.length(), fill + chunk);
+      rest = scanner.scan(rest, text.c_str() + fill, [&](const char *b, const char *e, uint64_t hash) {
+        assert(e[-1] == '\n');
+        assert(hash == hashBytes(b, e - b));
+        ++lines;
+      });
+    }
+
+    assert(lines == 300);
+    assert(std::string(rest) == "incomplete");
+  }
+
+  char wire[] =
+    "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n"
+    "5;x=y\r\nhello\r\n7\r\n world\n\r\n0\r\nTrailer: t\r\n\r\n"
+    "HTTP/1.1 404 Not Found\r\nContent-Length: 4\r\nConnection: close\r\n\r\ngone";
+  char *wireEnd = wire + sizeof(wire) - 1;
+
+  for(size_t chunk = 1; chunk < 40; ++chunk) {
+    char buffer[sizeof(wire)];
+    char *body = buffer, *fill = buffer;
+    std::string bodies;
+
+    HttpResponse response;
+    for(const char *next = wire; next != wireEnd; ) {
+      size_t n = std::min<size_t>(chunk, wireEnd - next);
+      memcpy(fill, next, n);
+      fill += n;
+      next += n;
+
+      while(body != fill) {
+        char *raw = body;
+        body = response.decode(body, raw, fill, [](const char *, const char *) {});
+        memmove(body, raw, fill - raw);
+        fill = body + (fill - raw);
+
+        if(!response.isComplete()) break;
+
+        bodies += std::string(buffer, body) + "|";
+        memmove(buffer, body, fill - body);
+        fill = buffer + (fill - body);
+        body = buffer;
+        response.reset();
+      }
+    }
+
+    assert(bodies == "hello world\n|gone|");
+  }
+
+  {
+    std::string copy(wire, wireEnd);
+    char *body = &copy[0], *raw = body, *e = body + copy.length();
+    int headers = 0;
+    auto countHeaders = [&](const char *, const char *) { ++headers; };
+
+    HttpResponse response;
+    body = response.decode(body, raw, e, countHeaders);
+    assert(response.isComplete() && response.isKeepAlive());
+    assert(response.getStatus() == 200);
+    assert(headers == 3);
+    assert(std::string(&copy[0], body) == "hello world\n");
+
+    response.reset();
+    headers = 0;
+    body = &copy[0];
+    body = response.decode(body, raw, e, countHeaders);
+    assert(response.isComplete() && !response.isKeepAlive());
+    assert(response.getStatus() == 404);
+    assert(headers == 4);
+    assert(std::string(&copy[0], body) == "gone");
+    assert(raw == e);
+  }
+
+  {
+    std::string redirect =
+      "HTTP/1.1 100 Continue\r\n\r\n"
+      "HTTP/1.1 301 Moved Permanently\r\nLocation: http://example.com/new\r\nContent-Length: 5\r\n\r\nmoved"
+      "HTTP/1.1 200 OK\r\nContent-Type: image/png\r\nTransfer-Encoding: chunked\r\n\r\n";
+    char *body = &redirect[0], *raw = body, *e = body + redirect.length();
+
+    HttpResponse response;
+    body = response.decode(body, raw, body + 30);
+    assert(!response.hasHeaders());
+
+    body = response.decode(body, raw, e);
+    assert(response.hasHeaders() && response.isComplete());
+    assert(response.getStatus() == 301 && response.isText());
+    assert(response.getLocation() == "http://example.com/new");
+    assert(response.getContentLength() == 5);
+
+    response.reset();
+    body = &redirect[0];
+    body = response.decode(body, raw, e);
+    assert(response.hasHeaders() && !response.isComplete());
+    assert(response.getStatus() == 200 && !response.isText());
+    assert(response.getLocation().empty());
+    assert(response.getContentLength() == -1);
+  }
+
+  {
+    std::string notModified =
+      "HTTP/1.1 304 Not Modified\r\nETag: \"abc\"\r\nLast-Modified: Sun, 06 Nov 1994 08:49:37 GMT\r\n\r\n";
+    char *body = &notModified[0], *raw = body;
+
+    HttpResponse response;
+    response.decode(body, raw, body + notModified.length());
+    assert(response.isComplete() && response.getStatus() == 304);
+    assert(response.getEtag() == "\"abc\"");
+    assert(response.getLastModified() == 784111777);
+
+    char date[HttpResponse::DATE_LENGTH + 1];
+    HttpResponse::formatDate(784111777, date);
+    assert(!strcmp(date, "Sun, 06 Nov 1994 08:49:37 GMT"));
+    assert(HttpResponse::parseDate(date, date + 10) == 0);
+  }
+
+  {
+    std::string hints =
+      "HTTP/1.1 103 Early Hints\r\nContent-Type: image/png\r\nLocation: /x\r\n\r\n"
+      "HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\nok";
+    char *body = &hints[0], *raw = body;
+
+    HttpResponse response;
+    body = response.decode(body, raw, body + hints.length());
+    assert(response.isComplete() && response.getStatus() == 200);
+    assert(response.isText() && response.getLocation().empty());
+
+    // the first line is part of the body as well
+    std::string text = "hello\nworld\n";
+    body = &text[0];
+    raw = body;
+    response.reset();
+    body = response.decode(body, raw, body + text.length());
+    response.handleEof();
+    assert(response.isComplete() && !response.isKeepAlive());
+    assert(std::string(&text[0], body) == "hello\nworld\n");
+  }
+
+  {
+    // start just below a level 1 and level 2 boundary to exercise cascading
+    uint64_t start = (1ull << 32) - 300;
+    TimerWheel timers(start);
+    assert(timers.nextTimeout(start) == -1);
+
+    uint64_t offsets[] = { 0, 1, 5, 255, 256, 299, 300, 301, 1000, 70000, 70001, 1ull << 20 };
+    const size_t n = sizeof(offsets) / sizeof(offsets[0]);
+    for(size_t i = n; i-- > 0;) timers.schedule(start + offsets[i], i);
+    timers.schedule(start - 10, n); // overdue
+
+    std::vector<uint64_t> fired;
+    uint64_t now = start;
+    while(!timers.empty()) {
+      int64_t timeout = timers.nextTimeout(now);
+      assert(timeout >= 0);
+      now += timeout;
+
+      timers.expire(now, [&](uint64_t id, uint64_t when) {
+        assert(when <= now);
+        if(id < n) assert(when == start + offsets[id] && now == when);
+        fired.push_back(id);
+      });
+    }
+
+    assert(fired.size() == n + 1);
+    assert((fired[0] == 0 && fired[1] == n) || (fired[0] == n && fired[1] == 0));
+    for(size_t i = 2; i < fired.size(); ++i) assert(fired[i] == i - 1);
+  }
+
+  {
+    for(int i = 0; i < 3; ++i) {
+      unlink(("tests.log." + std::to_string(i) + ".log").c_str());
+      unlink(("tests.log." + std::to_string(i) + ".idx").c_str());
+    }
+
+    {
+      // tiny segments, every block starts a new one
+      OutputLog log("tests.log", 1);
+      std::string data(300 * 1024, 'x');
+      log.append("example.com", "/a", data.data(), data.data() + data.length());
+      log.append("example.com", "/b", "bee\n", "bee\n" + 4);
+      log.flush();
+      log.append("example.org", "/", "", "");
+    }
+
+    std::vector<std::string> records;
+    for(int i = 0; i < 3; ++i) {
+      OutputLog::read("tests.log." + std::to_string(i) + ".log", [&](const std::string &host, const std::string &path, const std::string &data) {
+        records.push_back(host + path + " " + std::to_string(data.length()));
+      });
+    }
+
+    assert(records.size() == 3);
+    assert(records[0] == "example.com/a 307200");
+    assert(records[1] == "example.com/b 4");
+    assert(records[2] == "example.org/ 0");
+
+    std::ifstream index("tests.log.1.idx");
+    std::string line;
+    getline(index, line);
+    assert(line == "0 0 4 http://example.com/b");
+
+    for(int i = 0; i < 3; ++i) {
+      unlink(("tests.log." + std::to_string(i) + ".log").c_str());
+      unlink(("tests.log." + std::to_string(i) + ".idx").c_str());
+    }
+  }
+
+  {
+    BufferPool pool(128 * 1024);
+
+    size_t small = 100, large = 40000;
+    char *a = pool.allocate(small);
+    char *b = pool.allocate(large);
+    assert(small == BufferPool::MIN_SIZE && large == 65536);
+    assert(pool.getUsed() == small + large && pool.getReserved() == 128 * 1024);
+
+    memset(a, 1, small);
+    memset(b, 2, large);
+
+    pool.release(a, small);
+    size_t again = 4096;
+    assert(pool.allocate(again) == a);
+
+    size_t more = 65536;
+    pool.allocate(more);
+    assert(pool.getReserved() == 2 * 128 * 1024);
+  }
+
+  {
+    // no budget, every full segment but the first spills
+    FrontierSpill spill(".", 0);
+    PathFrontier front;
+    front.setSpill(&spill);
+
+    for(int i = 0; i < 5000; ++i) front.push_back("/some/directory/page" + std::to_string(i) + ".html");
+    assert(front.size() == 5000);
+    assert(spill.getSpilled() > 0);
+    assert(spill.getUsed() == front.getMemory() && front.getMemory() < 5000 * 10);
+
+    assert(front.front() == "/some/directory/page0.html");
+    assert(front.peek(3) == "/some/directory/page3.html");
+    for(int i = 0; i < 1000; ++i) front.pop_front();
+    assert(front.front() == "/some/directory/page1000.html");
+
+    front.removeIf([](const std::string &path) { return path.find('7') != std::string::npos; });
+    int n = 0;
+    front.each([&](const std::string &path) {
+      assert(path.find('7') == std::string::npos);
+      ++n;
+    });
+    assert(static_cast<size_t>(n) == front.size());
+
+    front.truncate(100);
+    assert(front.size() == 100);
+    for(int i = 0; i < 99; ++i) front.pop_front();
+    assert(front.front() == "/some/directory/page1120.html");
+
+    front.pop_front();
+    assert(front.empty());
+    assert(front.getMemory() == 0 && spill.getUsed() == 0 && spill.getSpilled() == 0);
+  }
+
+  {
+    HostFrontier hosts(3);
+    hosts.add("seed.example");
+    hosts.discover("seed.example", "/x");
+    hosts.discover("a.example", "/first");
+    hosts.discover("a.example", "/second");
+    hosts.discover("b.example", "/");
+    hosts.discover("c.example", "/");
+    assert(hosts.getHosts() == 3);
+    assert(hosts.getQueue() == std::vector<std::string>({ "http://a.example/first", "http://b.example/" }));
+
+    bool busy = false;
+    hosts.setBusy(busy, true);
+    std::vector<std::string> taken;
+    hosts.take(1, [&](const std::string &url) { taken.push_back(url); });
+    assert(taken == std::vector<std::string>({ "http://a.example/first" }));
+    assert(hosts.size() == 1 && !hosts.isDone());
+
+    hosts.take(5, [&](const std::string &url) { taken.push_back(url); });
+    assert(taken.size() == 2 && !hosts.isDone());
+    hosts.setBusy(busy, false);
+    assert(hosts.isDone());
+
+    hosts.hold(true);
+    assert(hosts.isIdle() && !hosts.isDone());
+    hosts.hold(false);
+  }
+
+  {
+    std::ofstream("tests.seeds") <<
+      "http://a.example/1\n  http://a.example/2 \n\n# comment\nhttp://a.example/3\n" <<
+      "not a url\nhttp://b.example/\nhttp://c.example/x\nhttp://a.example/4";
+
+    SeedFile seeds("tests.seeds", 0, 2);
+    std::string host;
+    std::vector<std::string> urls;
+    assert(seeds.next(host, urls) && host == "a.example");
+    assert(urls == std::vector<std::string>({ "http://a.example/1", "http://a.example/2" }));
+    uint64_t offset = seeds.getOffset();
+
+    seeds.setFilter([](const std::string &host) { return host != "b.example"; });
+    assert(seeds.next(host, urls) && host == "c.example" && urls.size() == 1);
+    assert(!seeds.next(host, urls) && seeds.isExhausted());
+
+    // continued where an earlier run stopped
+    SeedFile resumed("tests.seeds", offset, 10);
+    assert(resumed.next(host, urls) && host == "b.example" && urls.size() == 1);
+
+    HostFrontier hosts(10);
+    hosts.setSeeds(&resumed);
+    assert(!hosts.isIdle());
+    assert(hosts.takeSeeds(5, [&](const std::vector<std::string> &urls) { assert(!urls.empty()); }) == 1);
+    assert(hosts.isDone() && hosts.getHosts() == 1);
+
+    // known hosts survive a checkpoint
+    hosts.discover("d.example", "/");
+    std::stringstream saved;
+    hosts.save(saved);
+    uint64_t count;
+    saved >> count; saved.get();
+    HostFrontier restored(10);
+    restored.restore(BlockedBloomSet::load(saved), count);
+    restored.setSeeds(&resumed);
+    restored.discover("c.example", "/");
+    restored.discover("d.example", "/");
+    assert(restored.getHosts() == 2 && restored.size() == 0);
+
+    // unsorted, a.example comes back at the end; b.example was discovered and
+    // c.example is fetched already
+    SeedFile unsorted("tests.seeds", 0, 10);
+    HostFrontier known(10);
+    known.add("c.example");
+    known.discover("b.example", "/");
+    known.setSeeds(&unsorted);
+    std::vector<std::string> taken;
+    assert(known.takeSeeds(5, [&](const std::vector<std::string> &urls) { taken.push_back(urls[0]); }) == 2);
+    assert(taken == std::vector<std::string>({ "http://a.example/1", "http://b.example/" }));
+    known.discover("a.example", "/");
+    known.take(5, [](const std::string &) { assert(false); });
+    assert(known.isIdle() && known.getHosts() == 3);
+
+    // an earlier run handed out a.example
+    SeedFile later("tests.seeds", offset, 10);
+    assert(later.contains("a.example") && !later.contains("b.example"));
+    assert(later.next(host, urls) && host == "b.example");
+    assert(later.next(host, urls) && host == "c.example");
+    assert(!later.next(host, urls));
+
+    // far more seed hosts than the frontier expects, none is lost
+    {
+      std::ofstream many("tests.seeds");
+      for(int i = 0; i < 20000; ++i) many << "http://h" << i % 10000 << ".example/" << i << '\n';
+    }
+    SeedFile manySeeds("tests.seeds", 0, 10);
+    HostFrontier few(10);
+    few.setSeeds(&manySeeds);
+    assert(few.takeSeeds(30000, [](const std::vector<std::string> &urls) { assert(urls.size() == 1); }) == 10000);
+    assert(few.getHosts() == 10000 && few.isDone());
+
+    // hosts are keyed as Domain does, invalid ports are skipped
+    std::ofstream("tests.seeds") << "http://A.Example:80/x\nhttp://a.example/y\nhttp://b.example:99999/\nhttp://b.example:8080/";
+    SeedFile normalized("tests.seeds", 0, 10);
+    assert(normalized.next(host, urls) && host == "a.example");
+    assert(urls == std::vector<std::string>({ "http://a.example/x", "http://a.example/y" }));
+    assert(normalized.next(host, urls) && host == "b.example:8080" && urls.size() == 1);
+    assert(!normalized.next(host, urls));
+
+    unlink("tests.seeds");
+  }
+
+  {
+    // two shards on localhost, each owning one of the hosts
+    std::vector<std::string> peers { "127.0.0.1:17701", "127.0.0.1:17702" };
+    std::string own = "a.example", other = "b.example";
+    for(int i = 0; Shards::shardOf(own, 2) != 0 || Shards::shardOf(other, 2) != 1; ++i) {
+      own = "a" + std::to_string(i) + ".example";
+      other = "b" + std::to_string(i) + ".example";
+    }
+
+    HostFrontier hosts0(10), hosts1(10);
+    ScalableBloomSet lines0(100), lines1(100);
+    Shards shard0(0, peers), shard1(1, peers);
+    hosts0.setRouter([&](const std::string &host, const std::string &path) { return shard0.forwardHost(host, path); });
+    hosts1.setRouter([&](const std::string &host, const std::string &path) { return shard1.forwardHost(host, path); });
+    shard0.start(&hosts0, &lines0);
+    shard1.start(&hosts1, &lines1);
+
+    hosts0.discover(own, "/0");
+    hosts0.discover(other, "/1");
+    assert(hosts0.getQueue() == std::vector<std::string>({ "http://" + own + "/0" }));
+    shard0.forwardLine(12345);
+
+    for(int i = 0; i < 100 && !hosts1.size(); ++i) usleep(20000);
+    assert(hosts1.getQueue() == std::vector<std::string>({ "http://" + other + "/1" }));
+    for(int i = 0; i < 100 && !lines1.contains(12345); ++i) usleep(20000);
+    assert(lines1.contains(12345) && !lines0.contains(12345));
+
+    // done once both are idle and nothing is in flight
+    hosts0.take(1, [](const std::string &) { });
+    hosts1.take(1, [](const std::string &) { });
+    for(int i = 0; i < 200 && !(hosts0.isDone() && hosts1.isDone()); ++i) usleep(20000);
+    assert(hosts0.isDone() && hosts1.isDone());
+  }
+
+  {
+    // shard 0 reaches shard 1 through a relay, which breaks off the first
+    // connection in the middle of a frame, without passing on acknowledgements
+    std::vector<std::string> peers0 { "127.0.0.1:17711", "127.0.0.1:17713" }, peers1 { "127.0.0.1:17711", "127.0.0.1:17712" };
+    HostFrontier hosts0(10000), hosts1(10000);
+    ScalableBloomSet lines0(100), lines1(100);
+    Shards shard0(0, peers0), shard1(1, peers1);
+    hosts0.setRouter([&](const std::string &host, const std::string &path) { return shard0.forwardHost(host, path); });
+
+    std::vector<std::string> sent;
+    for(int i = 0; sent.size() < 1000; ++i) {
+      std::string host = "h" + std::to_string(i) + ".example";
+      if(Shards::shardOf(host, 2) != 1) continue;
+      hosts0.discover(host, "/");
+      sent.push_back("http://" + host + "/");
+    }
+
+    sockaddr_in relayAddr, targetAddr;
+    memset(&relayAddr, 0, sizeof(relayAddr));
+    relayAddr.sin_family = AF_INET;
+    relayAddr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    targetAddr = relayAddr;
+    relayAddr.sin_port = htons(17713);
+    targetAddr.sin_port = htons(17712);
+
+    int relay = socket(AF_INET, SOCK_STREAM, 0), one = 1;
+    setsockopt(relay, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    assert(!bind(relay, reinterpret_cast<sockaddr *>(&relayAddr), sizeof(relayAddr)) && !listen(relay, 4));
+
+    std::atomic<bool> stop(false);
+    std::thread relayThread([&] {
+      auto sendAll = [](int fd, const char *b, ssize_t n) {
+        for(ssize_t w; n > 0; b += w, n -= w) if((w = send(fd, b, n, MSG_NOSIGNAL)) <= 0) return false;
+        return true;
+      };
+
+      for(int connection = 0; !stop; ++connection) {
+        int in = accept(relay, 0, 0);
+        if(in < 0) break;
+        int out = socket(AF_INET, SOCK_STREAM, 0);
+        assert(!connect(out, reinterpret_cast<sockaddr *>(&targetAddr), sizeof(targetAddr)));
+
+        char b[64 * 1024];
+        if(!connection) {
+          ssize_t n = 0, r;
+          while(n < 1000 && (r = recv(in, b + n, 1000 - n, 0)) > 0) n += r;
+          sendAll(out, b, n);
+        } else {
+          pollfd fds[2] = { { in, POLLIN, 0 }, { out, POLLIN, 0 } };
+          for(bool open = true; open && !stop;) {
+            if(poll(fds, 2, 50) <= 0) continue;
+            for(int k = 0; k < 2 && open; ++k) {
+              if(!fds[k].revents) continue;
+              ssize_t r = recv(fds[k].fd, b, sizeof(b), 0);
+              open = r > 0 && sendAll(fds[1 - k].fd, b, r);
+            }
+          }
+        }
+
+        close(in);
+        close(out);
+      }
+    });
+
+    shard0.start(&hosts0, &lines0);
+    shard1.start(&hosts1, &lines1);
+
+    for(int i = 0; i < 250 && hosts1.size() < sent.size(); ++i) usleep(20000);
+    assert(hosts1.getQueue() == sent);
+
+    hosts0.take(sent.size(), [](const std::string &) { });
+    hosts1.take(sent.size(), [](const std::string &) { });
+    for(int i = 0; i < 250 && !(hosts0.isDone() && hosts1.isDone()); ++i) usleep(20000);
+    assert(hosts0.isDone() && hosts1.isDone());
+
+    stop = true;
+    shutdown(relay, SHUT_RDWR);
+    relayThread.join();
+    close(relay);
+  }
+
+  {
+    SocketAddress a, b;
+    assert(a.parse("127.0.0.2") && !a.isIpv6() && a.getServer() == 0x0200007f);
+    assert(b.parse("2001:db8::1") && b.isIpv6() && b.toString() == "2001:db8::1");
+    assert(b.getLength() == sizeof(sockaddr_in6) && b.getServer() != a.getServer());
+    assert(!a.parse("example.com") && a.toString() == "127.0.0.2");
+
+    a.setPort(8080);
+    assert(!(a == SocketAddress::ipv4(0x0200007f, 80)) && a == SocketAddress::ipv4(0x0200007f, 8080));
+  }
+
+  {
+    DnsCache cache;
+    std::vector<SocketAddress> addresses(2);
+    addresses[0].parse("127.0.0.1");
+    addresses[1].parse("::1");
+    cache.insert("a.example", addresses, 1000);
+    cache.insert("b.example", std::vector<SocketAddress>(1, SocketAddress::ipv4(0x0200007f, 0)), 2000);
+
+    std::vector<SocketAddress> found;
+    assert(cache.lookup("a.example", found, 999) && found.size() == 2 && found[1].toString() == "::1");
+    assert(!cache.lookup("c.example", found, 999));
+
+    std::stringstream saved;
+    cache.save(saved, 1500);
+    assert(saved.str() == "b.example 2000 127.0.0.2\n");
+
+    DnsCache loaded;
+    loaded.load(saved, 1500);
+    assert(loaded.size() == 1 && loaded.lookup("b.example", found, 1500) && found.size() == 1 && found[0].getServer() == 0x0200007f);
+    assert(!loaded.lookup("b.example", found, 2000) && loaded.size() == 0);
+  }
+
+  {
+    AdaptiveLimit limit(128, 8, 1024);
+    for(uint64_t i = 0; i < AdaptiveLimit::WINDOW; ++i) limit.record(false);
+    assert(limit.get() == 145);
+    for(uint64_t i = 0; i < AdaptiveLimit::WINDOW; ++i) limit.record(i < 1);
+    assert(limit.get() == 145);
+    for(uint64_t i = 0; i < AdaptiveLimit::WINDOW; ++i) limit.record(i < 3);
+    assert(limit.get() == 72);
+    for(int n = 0; n < 10; ++n) for(uint64_t i = 0; i < AdaptiveLimit::WINDOW; ++i) limit.record(true);
+    assert(limit.get() == 8);
+  }
+
+  {
+    HostPace fixed;
+    fixed.setCooldown(5000);
+    fixed.setMaxDepth(4);
+    for(uint64_t i = 0; i < 4 * HostPace::WINDOW; ++i) fixed.record(1000, true);
+    assert(fixed.getCooldown() == 5000 && fixed.getDepth() == 4);
+    fixed.setFloor(8000);
+    assert(fixed.getCooldown() == 8000 && fixed.getDepth() == 1);
+
+    HostPace pace;
+    pace.setCooldown(1000);
+    pace.setMaxDepth(4);
+    pace.setBounds(250, 4000);
+    assert(pace.getCooldown() == 1000 && pace.getDepth() == 1);
+
+    // fast and clean: more in flight, shorter pauses
+    for(uint64_t i = 0; i < 3 * HostPace::WINDOW; ++i) pace.record(1000, false);
+    assert(pace.getDepth() == 4 && pace.getCooldown() == 1000 - 250 - 188 - 141);
+    for(uint64_t i = 0; i < 20 * HostPace::WINDOW; ++i) pace.record(1000, false);
+    assert(pace.getDepth() == 4 && pace.getCooldown() == 250);
+
+    // errors or slow responses back off
+    for(uint64_t i = 0; i < HostPace::WINDOW; ++i) pace.record(1000, i < 1);
+    assert(pace.getDepth() == 2 && pace.getCooldown() == 500);
+    for(uint64_t i = 0; i < HostPace::WINDOW; ++i) pace.record(50000, false); // within the slack
+    assert(pace.getDepth() == 3 && pace.getCooldown() == 375);
+    for(uint64_t i = 0; i < HostPace::WINDOW; ++i) pace.record(60000, false);
+    assert(pace.getDepth() == 1 && pace.getCooldown() == 750);
+    for(uint64_t i = 0; i < 4 * HostPace::WINDOW; ++i) pace.record(60000, false);
+    assert(pace.getCooldown() == 4000);
+
+    // Crawl-delay is the floor, also beyond the bounds
+    pace.setFloor(10000);
+    assert(pace.getCooldown() == 10000);
+    for(uint64_t i = 0; i < 20 * HostPace::WINDOW; ++i) pace.record(1000, false);
+    assert(pace.getCooldown() == 10000);
+    pace.setFloor(1000000);
+    assert(pace.getCooldown() == HostPace::MAX_CRAWL_DELAY_MILLISECONDS);
+  }
+
+  {
+    IpCooldown cooldown;
+    assert(cooldown.reserve(1, 1000, 500) == 1000);
+    assert(cooldown.reserve(1, 1200, 500) == 1500);
+    assert(cooldown.reserve(2, 1200, 500) == 1200);
+    assert(cooldown.reserve(1, 1500, 500) == 1500);
+  }
+
+  {
+    SimHash a, b, c;
+    for(int i = 0; i < 200; ++i) {
+      std::string line = "line " + std::to_string(i);
+      a.add(hashBytes(line.c_str(), line.length()));
+      if(i == 5 || i == 77) line += " changed";
+      b.add(hashBytes(line.c_str(), line.length()));
+      line = "other " + std::to_string(i);
+      c.add(hashBytes(line.c_str(), line.length()));
+    }
+    assert(a.getLines() == 200);
+
+    SimHashIndex index(3, 3);
+    assert(!index.check(a.get()));
+    assert(index.check(b.get()));
+    assert(!index.check(c.get()));
+    assert(index.getSize() == 2 && index.getDuplicates() == 1);
+
+    // full, starts over
+    assert(!index.check(a.get() ^ 0xffff));
+    assert(!index.check(a.get() ^ 0xffff0000));
+    assert(!index.check(a.get()));
+    assert(index.getSize() == 2);
+
+    a.reset();
+    assert(a.getLines() == 0 && a.get() == 0);
+  }
+
+  RobotsRules robots;
+
+  assert(!robots.disallows("/anything"));
+
+  robots.insert("/log/", false);
+  robots.insert("/blog", false);
+  robots.insert("", false);
+
+  assert(robots.disallows("/log/abcdef"));
+  assert(!robots.disallows("/logabcdef"));
+  assert(!robots.disallows("logabcdef"));
+  assert(!robots.disallows("/blorg"));
+  assert(robots.disallows("/blog/what"));
+  assert(robots.disallows("/blogwhat"));
+
+  robots.insert("/log/public/", true);
+  robots.insert("/*.pdf$", false);
+  robots.insert("/blog*/drafts", false);
+  robots.insert("/blog/", true);
+  robots.insert("/blo", true);
+
+  assert(robots.disallows("/log/private"));
+  assert(!robots.disallows("/log/public/x"));
+  assert(robots.disallows("/files/a.pdf"));
+  assert(!robots.disallows("/files/a.pdf?x"));
+  assert(robots.disallows("/blog/2020/drafts/1"));
+  assert(!robots.disallows("/blog/2020/final"));
+  assert(robots.disallows("/blogx"));
+  assert(robots.size() == 7);
+
+  RobotsRules copy = robots;
+  assert(copy.disallows("/log/private") && !copy.disallows("/log/public/x"));
+
+  RobotsRules tie;
+  tie.insert("/page", false);
+  tie.insert("/pag*", true);
+  assert(!tie.disallows("/page"));
 
   PostfixSet postfix;
 
@@ -41,5 +780,153 @@ int main(void) {
   assert(postfix.matches("someother"));
   assert(postfix.matches(""));
 
+  LinkScanner linkScanner;
+  std::vector<std::string> links;
+  auto collect = [&](const char *b, const char *e, LinkScanner::Kind kind) {
+    links.push_back((kind == LinkScanner::BASE? "base:": "") + std::string(b, e));
+  };
+
+  std::string html =
+    "<html><head><BASE HREF=\"http://other.test/dir/\"><!-- <a href=\"/comment\"> -->"
+    "<script>var s = '<a href=\"/script\">';</script></head>"
+    "<body><a class=x href = '/one?a=1&amp;b=2'>one</a> <img src=/two.png>"
+    "<a name=\"href\" title=\"src=/none\">x</a><A\nHREF=\"/three\"></a></body></html>";
+
+  // the same links, whichever way the body is split into chunks
+  for(size_t chunk = 1; chunk <= html.length(); ++chunk) {
+    links.clear();
+    linkScanner.reset();
+    for(size_t i = 0; i < html.length(); i += chunk) {
+      linkScanner.scan(html.data() + i, html.data() + std::min(i + chunk, html.length()), collect);
+    }
+
+    assert(links.size() == 4);
+    assert(links[0] == "base:http://other.test/dir/");
+    assert(links[1] == "/one?a=1&b=2");
+    assert(links[2] == "/two.png");
+    assert(links[3] == "/three");
+  }
+
+  links.clear();
+  linkScanner.reset();
+  std::string entities = "<a href=\"/&#x41;&#66;&unknown;&lt\">";
+  linkScanner.scan(entities.data(), entities.data() + entities.length(), collect);
+  assert(links.size() == 1 && links[0] == "/AB&unknown;&lt");
+
+  Histogram histogram;
+  assert(histogram.quantile(0.5) == 0);
+
+  for(uint64_t v = 1; v <= 1000; ++v) histogram.record(v * 1000);
+  assert(histogram.getCount() == 1000);
+  assert(histogram.getSum() == 500500000);
+  assert(histogram.countBelow(1 << 10) == 1);
+  assert(histogram.countBelow(1 << 20) == 1000);
+
+  // within the 12.5% of a bucket
+  uint64_t median = histogram.quantile(0.5);
+  assert(median >= 500000 && median <= 500000 * 9 / 8);
+  uint64_t top = histogram.quantile(0.99);
+  assert(top >= 990000 && top <= 990000 * 9 / 8);
+
+  Metrics metrics;
+  metrics.counter("test_total", "Test counter.").add(3);
+  metrics.counter("test_total", "Test counter.").add(); // the same counter
+  metrics.gauge("test_gauge", "Test gauge.").set(0.5);
+  metrics.histogram("test_seconds", "Test histogram.").record(100);
+
+  std::ostringstream exported;
+  metrics.write(exported);
+  std::string prometheus = exported.str();
+  assert(prometheus.find("# TYPE test_total counter\ntest_total 4\n") != std::string::npos);
+  assert(prometheus.find("test_gauge 0.5\n") != std::string::npos);
+  assert(prometheus.find("test_seconds_bucket{le=\"6.4e-05\"} 0\n") != std::string::npos);
+  assert(prometheus.find("test_seconds_bucket{le=\"0.000128\"} 1\n") != std::string::npos);
+  assert(prometheus.find("test_seconds_bucket{le=\"+Inf\"} 1\ntest_seconds_sum 0.0001\ntest_seconds_count 1\n") != std::string::npos);
+
+  // gzip, zlib and raw deflate, fed and drained in small pieces
+  std::string original;
+  for(int i = 0; i < 2000; ++i) original += "line " + std::to_string(i % 300) + " of a compressible page\n";
+
+  Inflater inflater;
+  for(int windowBits: { 15 + 16, 15, -15 }) {
+    z_stream deflater;
+    memset(&deflater, 0, sizeof(deflater));
+    deflateInit2(&deflater, 6, Z_DEFLATED, windowBits, 8, Z_DEFAULT_STRATEGY);
+
+    std::string compressed(deflateBound(&deflater, original.length()), 0);
+    deflater.next_in = reinterpret_cast<Bytef *>(&original[0]);
+    deflater.avail_in = original.length();
+    deflater.next_out = reinterpret_cast<Bytef *>(&compressed[0]);
+    deflater.avail_out = compressed.length();
+    assert(deflate(&deflater, Z_FINISH) == Z_STREAM_END);
+    compressed.resize(deflater.total_out);
+    deflateEnd(&deflater);
+
+    compressed += "trailing garbage";
+
+    inflater.reset();
+    std::string decompressed;
+    char out[100];
+    for(size_t i = 0; i < compressed.length(); i += 7) {
+      const char *in = compressed.data() + i, *inEnd = compressed.data() + std::min(i + 7, compressed.length());
+
+      while(in != inEnd) {
+        char *o = out;
+        assert(inflater.inflate(in, inEnd, o, out + sizeof(out)));
+        decompressed.append(out, o);
+      }
+    }
+
+    assert(decompressed == original);
+  }
+
+  inflater.reset();
+  {
+    // gzip header, then a block of the reserved type 3
+    std::string corrupt("\x1f\x8b\x08\x00\x00\x00\x00\x00\x00\x03\x07garbage", 18);
+    const char *in = corrupt.data();
+    char out[100], *o = out;
+    assert(!inflater.inflate(in, corrupt.data() + corrupt.length(), o, out + sizeof(out)));
+  }
+
+  unlink("tests.urls");
+  {
+    UrlMetadataStore store("tests.urls");
+    UrlMetadata m;
+
+    // enough to grow the table twice
+    for(uint64_t i = 0; i < 200000; ++i) {
+      m.etag = i % 2? "\"" + std::to_string(i) + "\"": "";
+      m.lastModified = i;
+      m.fetched = 1000 + i;
+      m.contentHash = i * 3;
+      store.update(i + 1, m);
+    }
+    m.etag = std::string(UrlMetadataStore::MAX_ETAG + 1, 'x');
+    store.update(200001, m);
+    assert(store.size() == 200001);
+  }
+  {
+    UrlMetadataStore store("tests.urls");
+    UrlMetadata m;
+
+    assert(store.size() == 200001);
+    assert(!store.lookup(300000, m));
+    assert(store.lookup(1, m) && m.etag.empty() && m.contentHash == 0);
+    assert(store.lookup(12346, m) && m.etag == "\"12345\"" && m.lastModified == 12345 && m.fetched == 13345 && m.contentHash == 37035);
+
+    // too long to be kept
+    assert(store.lookup(200001, m) && m.etag.empty());
+  }
+  unlink("tests.urls");
+
+  bool mismatch = false;
+  try {
+    metrics.gauge("test_total", "Wrong type.");
+  } catch(std::runtime_error &) {
+    mismatch = true;
+  }
+  assert(mismatch);
+
   return 0;
 }